@@ -0,0 +1,152 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures how decoding of a /sync response scales with the number of
+ * threads. A synthetic response with many rooms is decoded with
+ * SyncJob::decodeBody() in a task of the global QThreadPool, as
+ * SyncJob does it, for each thread count from 1 to the number of cores.
+ *
+ * Usage: syncdecode [rooms [events per room [repeats]]]
+ */
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QJsonArray>
+#include <QtCore/QThreadPool>
+#include <QtCore/QThread>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QTextStream>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "../jobs/syncjob.h"
+
+using namespace QMatrixClient;
+
+static QJsonObject makeEvent(const QString& type, const QString& roomId,
+                             int index, const QJsonObject& content)
+{
+    QJsonObject event;
+    event.insert("type", type);
+    event.insert("event_id", QString("$%1:example.org").arg(index));
+    event.insert("room_id", roomId);
+    event.insert("sender", QString("@user%1:example.org").arg(index % 20));
+    event.insert("origin_server_ts", 1480000000000.0 + index);
+    event.insert("content", content);
+    return event;
+}
+
+static QByteArray makeResponse(int roomCount, int eventCount)
+{
+    QJsonObject join;
+    for( int r = 0; r < roomCount; ++r )
+    {
+        const QString roomId = QString("!room%1:example.org").arg(r);
+        QJsonArray state;
+        for( int m = 0; m < 20; ++m )
+        {
+            QJsonObject content;
+            content.insert("membership", QString("join"));
+            content.insert("displayname", QString("User %1").arg(m));
+            QJsonObject member = makeEvent("m.room.member", roomId, m, content);
+            member.insert("state_key", QString("@user%1:example.org").arg(m));
+            state.append(member);
+        }
+        QJsonArray timeline;
+        for( int e = 0; e < eventCount; ++e )
+        {
+            QJsonObject content;
+            content.insert("msgtype", QString("m.text"));
+            content.insert("body", QString("Message %1 in room %2").arg(e).arg(r));
+            timeline.append(makeEvent("m.room.message", roomId, 100 + e, content));
+        }
+        QJsonObject room;
+        room.insert("state", QJsonObject { { "events", state } });
+        room.insert("timeline", QJsonObject { { "events", timeline },
+                                              { "limited", true },
+                                              { "prev_batch", QString("p%1").arg(r) } });
+        join.insert(roomId, room);
+    }
+    QJsonObject rooms;
+    rooms.insert("join", join);
+    QJsonObject response;
+    response.insert("next_batch", QString("s1"));
+    response.insert("rooms", rooms);
+    return QJsonDocument(response).toJson(QJsonDocument::Compact);
+}
+
+/** Returns the time of decoding in ms, or -1 if it has failed */
+static qint64 decode(const QByteArray& body)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QList<SyncRoomData> rooms;
+    const bool ok = QtConcurrent::run([&] {
+        return SyncJob::decodeBody(body, rooms);
+    }).result();
+    const qint64 elapsed = timer.elapsed();
+    for( SyncRoomData& roomData: rooms )
+        roomData.deleteEvents();
+    return ok ? elapsed : -1;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    // SyncRoomData and events log a lot at the debug level
+    QLoggingCategory::setFilterRules("*.debug=false");
+
+    const QStringList args = app.arguments();
+    const int roomCount = args.size() > 1 ? args[1].toInt() : 2000;
+    const int eventCount = args.size() > 2 ? args[2].toInt() : 20;
+    const int repeats = args.size() > 3 ? args[3].toInt() : 3;
+
+    QTextStream out(stdout);
+    const QByteArray body = makeResponse(roomCount, eventCount);
+    out << "Decoding " << roomCount << " rooms, " << eventCount
+        << " messages each (" << body.size() / 1024 << " KiB)" << endl;
+
+    QThreadPool* pool = QThreadPool::globalInstance();
+    decode(body); // Warm up
+    qint64 serial = 0;
+    for( int threads = 1; threads <= QThread::idealThreadCount(); ++threads )
+    {
+        pool->setMaxThreadCount(threads);
+        qint64 best = -1;
+        for( int i = 0; i < repeats; ++i )
+        {
+            const qint64 elapsed = decode(body);
+            if( elapsed < 0 )
+            {
+                out << "Decoding has failed" << endl;
+                return 1;
+            }
+            if( best < 0 || elapsed < best )
+                best = elapsed;
+        }
+        if( threads == 1 )
+            serial = best;
+        out << threads << " thread(s): " << best << " ms";
+        if( best > 0 )
+            out << ", speedup " << double(serial) / best;
+        out << endl;
+    }
+    return 0;
+}
@@ -32,11 +32,26 @@
 #include "jobs/roommessagesjob.h"
 #include "jobs/syncjob.h"
 #include "jobs/mediathumbnailjob.h"
+#include "filter.h"
 
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QCborValue>
+#include <QtCore/QJsonObject>
 #include <QtCore/QDebug>
 
 using namespace QMatrixClient;
 
+// Bump this whenever the layout of the saved state changes
+static const int StateCacheVersion = 2;
+
+static const struct { const char* jsonKey; JoinState enumVal; } roomStates[]
+{
+    { "join", JoinState::Join },
+    { "invite", JoinState::Invite },
+    { "leave", JoinState::Leave }
+};
+
 Connection::Connection(QUrl server, QObject* parent)
     : QObject(parent)
 {
@@ -107,23 +122,89 @@ void Connection::logout()
 
 SyncJob* Connection::sync(int timeout)
 {
-    QString filter = "{\"room\": { \"timeline\": { \"limit\": 100 } } }";
-    SyncJob* syncJob = new SyncJob(d->data, d->data->lastEvent());
-    syncJob->setFilter(filter);
-    syncJob->setTimeout(timeout);
-    connect( syncJob, &SyncJob::success, [=] () {
-        d->data->setLastEvent(syncJob->nextBatch());
-        d->processRooms(syncJob->roomData());
-        emit syncDone();
-    });
-    connect( syncJob, &SyncJob::failure, [=] () {
-        if (syncJob->error() == BaseJob::ContentAccessError)
-            emit loginError(syncJob->errorString());
-        else
-            emit connectionError(syncJob->errorString());
-    });
-    syncJob->start();
-    return syncJob;
+    return d->startSync(d->data->lastEvent(), timeout);
+}
+
+void Connection::startSyncLoop()
+{
+    if( d->syncLoopRunning )
+        return;
+    d->syncLoopRunning = true;
+    // Otherwise the loop picks up after the sync in progress
+    if( d->syncJobs.isEmpty() )
+        d->nextSync(d->data->lastEvent());
+}
+
+void Connection::stopSyncLoop()
+{
+    d->syncLoopRunning = false;
+    d->syncTimer.stop();
+    for( SyncJob* job: d->syncJobs )
+    {
+        d->dropDeferred(job);
+        if( !d->deferredResults.contains(job) )
+            job->kill();
+        job->deleteLater();
+    }
+    d->syncJobs.clear();
+    d->deferredResults.clear();
+}
+
+bool Connection::isSyncLoopRunning() const
+{
+    return d->syncLoopRunning;
+}
+
+void Connection::setSyncMode(SyncMode mode)
+{
+    const SyncMode oldMode = d->syncMode;
+    d->syncMode = mode;
+    // Don't wait for the rest of the idle pause
+    if( oldMode == SyncMode::Idle && mode == SyncMode::Active &&
+            d->syncTimer.isActive() && d->syncJobs.isEmpty() )
+    {
+        d->syncTimer.stop();
+        d->nextSync(d->data->lastEvent());
+    }
+}
+
+Connection::SyncMode Connection::syncMode() const
+{
+    return d->syncMode;
+}
+
+void Connection::setSyncTimeout(int msecs)
+{
+    d->syncTimeout = msecs;
+}
+
+int Connection::syncTimeout() const
+{
+    return d->syncTimeout;
+}
+
+void Connection::setIdleSyncInterval(int msecs)
+{
+    d->idleSyncInterval = msecs;
+}
+
+int Connection::idleSyncInterval() const
+{
+    return d->idleSyncInterval;
+}
+
+void Connection::setSyncFilter(const Filter& filter)
+{
+    if( filter == d->syncFilter )
+        return;
+    d->syncFilter = filter;
+    // Looked up or uploaded with the next sync
+    d->syncFilterId.clear();
+}
+
+Filter Connection::syncFilter() const
+{
+    return d->syncFilter;
 }
 
 void Connection::postMessage(Room* room, QString type, QString message)
@@ -176,6 +257,78 @@ MediaThumbnailJob* Connection::getThumbnail(QUrl url, int requestedWidth, int re
     return job;
 }
 
+bool Connection::saveState(const QString& toFile) const
+{
+    QJsonObject rooms;
+    for( auto roomState: roomStates )
+    {
+        QJsonObject rs;
+        for( Room* r: d->roomMap )
+            if( r->joinState() == roomState.enumVal )
+                rs.insert(r->id(), r->toJson());
+        rooms.insert(roomState.jsonKey, rs);
+    }
+
+    QJsonObject state;
+    state.insert("cache_version", StateCacheVersion);
+    state.insert("next_batch", d->data->lastEvent());
+    state.insert("rooms", rooms);
+
+    // CBOR is both more compact and faster to load than JSON text
+    QSaveFile file(toFile);
+    if( !file.open(QFile::WriteOnly) )
+    {
+        qWarning() << "Couldn't save the state to" << toFile << ":" << file.errorString();
+        return false;
+    }
+    file.write(QCborValue::fromJsonValue(state).toCbor());
+    if( !file.commit() )
+    {
+        qWarning() << "Couldn't save the state to" << toFile << ":" << file.errorString();
+        return false;
+    }
+    qDebug() << "State of" << d->roomMap.size() << "room(s) saved to" << toFile;
+    return true;
+}
+
+bool Connection::loadState(const QString& fromFile)
+{
+    // saveState() needs the original JSON of events, even if there's
+    // nothing to load yet
+    Event::setKeepOriginalJson(true);
+    QFile file(fromFile);
+    if( !file.open(QFile::ReadOnly) )
+    {
+        qDebug() << "No saved state found at" << fromFile;
+        return false;
+    }
+    QCborParserError error;
+    const QCborValue cbor = QCborValue::fromCbor(file.readAll(), &error);
+    const QJsonObject state = cbor.toJsonValue().toObject();
+    if( error.error != QCborError::NoError ||
+            state.value("cache_version").toInt() != StateCacheVersion )
+    {
+        qWarning() << "Ignoring the saved state at" << fromFile
+                   << "- unknown or broken format";
+        return false;
+    }
+
+    const QJsonObject rooms = state.value("rooms").toObject();
+    for( auto roomState: roomStates )
+    {
+        const QJsonObject rs = rooms.value(roomState.jsonKey).toObject();
+        for( auto r = rs.begin(); r != rs.end(); ++r )
+        {
+            SyncRoomData roomData(r.key(), r.value().toObject(), roomState.enumVal);
+            d->processRoom(roomData);
+            roomData.deleteEvents();
+        }
+    }
+    d->data->setLastEvent(state.value("next_batch").toString());
+    qDebug() << "State of" << d->roomMap.size() << "room(s) loaded from" << fromFile;
+    return true;
+}
+
 User* Connection::user(QString userId)
 {
     if( d->userMap.contains(userId) )
@@ -202,6 +355,16 @@ QString Connection::token()
     return d->data->token();
 }
 
+void Connection::setTimelineBudget(int maxEvents)
+{
+    d->timelineBudget = maxEvents;
+}
+
+int Connection::timelineBudget() const
+{
+    return d->timelineBudget;
+}
+
 QHash< QString, Room* > Connection::roomMap() const
 {
     return d->roomMap;
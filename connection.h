@@ -28,6 +28,7 @@ namespace QMatrixClient
     class Event;
     class ConnectionPrivate;
     class ConnectionData;
+    class Filter;
 
     class SyncJob;
     class RoomMessagesJob;
@@ -37,6 +38,8 @@ namespace QMatrixClient
     class Connection: public QObject {
             Q_OBJECT
         public:
+            enum class SyncMode { Active, Idle };
+
             Connection(QUrl server, QObject* parent = nullptr);
             Connection();
             virtual ~Connection();
@@ -50,7 +53,47 @@ namespace QMatrixClient
             Q_INVOKABLE virtual void reconnect();
             Q_INVOKABLE virtual void logout();
 
+            /**
+             * Makes a single sync; should not be used while the sync loop
+             * is running. The job is deleted after its results are applied.
+             */
             Q_INVOKABLE virtual SyncJob* sync(int timeout=-1);
+            /**
+             * @brief Keeps syncing with the server until stopSyncLoop()
+             *
+             * In the Active mode, the next sync is requested as soon as
+             * next_batch of the previous one is known, while the rooms from
+             * the previous one are still being applied; results are always
+             * applied in order and syncDone() is emitted for each sync.
+             * In the Idle mode, syncs are made one at a time, with
+             * idleSyncInterval() between them, and the user is reported
+             * as unavailable. After an error the loop makes a pause
+             * and starts over from the last applied sync; on loginError()
+             * it stops.
+             */
+            Q_INVOKABLE virtual void startSyncLoop();
+            /** Stops the loop and cancels the syncs that are in progress */
+            Q_INVOKABLE virtual void stopSyncLoop();
+            bool isSyncLoopRunning() const;
+            void setSyncMode(SyncMode mode);
+            SyncMode syncMode() const;
+            /** How long the server may hold a sync request, 30 s by default */
+            void setSyncTimeout(int msecs);
+            int syncTimeout() const;
+            /** The pause between syncs in the Idle mode, 60 s by default */
+            void setIdleSyncInterval(int msecs);
+            int idleSyncInterval() const;
+            /**
+             * @brief Sets the filter for the following syncs
+             *
+             * The filter is uploaded to the server once per account; its id
+             * is cached on disk, so that later syncs, in this session and
+             * the following ones, only pass the id. Until the id is known,
+             * syncs pass the filter inline. The default filter limits
+             * timelines to 100 events.
+             */
+            void setSyncFilter(const Filter& filter);
+            Filter syncFilter() const;
             Q_INVOKABLE virtual void postMessage( Room* room, QString type, QString message );
             Q_INVOKABLE virtual PostReceiptJob* postReceipt( Room* room, Event* event );
             Q_INVOKABLE virtual void joinRoom( QString roomAlias );
@@ -59,6 +102,35 @@ namespace QMatrixClient
             Q_INVOKABLE virtual RoomMessagesJob* getMessages( Room* room, QString from );
             virtual MediaThumbnailJob* getThumbnail( QUrl url, int requestedWidth, int requestedHeight );
 
+            /**
+             * @brief Saves rooms and the sync token to a file
+             *
+             * The snapshot includes the current state of each room and the
+             * tail of its timeline; restoring it with loadState() allows
+             * to continue with an incremental sync instead of a full one.
+             */
+            Q_INVOKABLE virtual bool saveState(const QString& toFile) const;
+            /**
+             * @brief Restores rooms and the sync token saved by saveState()
+             *
+             * Should be called before the first sync(), even if there's no
+             * saved state yet: it turns on Event::setKeepOriginalJson(),
+             * and saveState() leaves out events that came before that.
+             */
+            Q_INVOKABLE virtual bool loadState(const QString& fromFile);
+
+            /**
+             * @brief Limits the number of events kept in memory by all rooms
+             *
+             * After each sync, if the rooms hold more events than this,
+             * the ones with the oldest latest event are trimmed first (see
+             * Room::trimTimeline()). 0 (the default) means no limit.
+             * Like Room::setTimelineLimit(), this bounds the number of
+             * timeline events rather than the memory used by them.
+             */
+            void setTimelineBudget(int maxEvents);
+            int timelineBudget() const;
+
             Q_INVOKABLE virtual User* user(QString userId);
             Q_INVOKABLE virtual User* user();
             Q_INVOKABLE virtual QString userId();
@@ -20,6 +20,8 @@
 
 #include <QtNetwork/QNetworkAccessManager>
 
+#include "jobs/jobscheduler.h"
+
 using namespace QMatrixClient;
 
 class ConnectionData::Private
@@ -32,6 +34,7 @@ class ConnectionData::Private
         QString token;
         QString lastEvent;
         QNetworkAccessManager* nam;
+        JobScheduler* scheduler;
 };
 
 ConnectionData::ConnectionData(QUrl baseUrl)
@@ -39,10 +42,12 @@ ConnectionData::ConnectionData(QUrl baseUrl)
 {
     d->baseUrl = baseUrl;
     d->nam = new QNetworkAccessManager();
+    d->scheduler = new JobScheduler();
 }
 
 ConnectionData::~ConnectionData()
 {
+    d->scheduler->deleteLater();
     d->nam->deleteLater();
     delete d;
 }
@@ -67,6 +72,11 @@ QNetworkAccessManager* ConnectionData::nam() const
     return d->nam;
 }
 
+JobScheduler* ConnectionData::scheduler() const
+{
+    return d->scheduler;
+}
+
 void ConnectionData::setToken(QString token)
 {
     d->token = token;
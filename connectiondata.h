@@ -25,6 +25,8 @@ class QNetworkAccessManager;
 
 namespace QMatrixClient
 {
+    class JobScheduler;
+
     class ConnectionData
     {
         public:
@@ -36,6 +38,8 @@ namespace QMatrixClient
             QUrl baseUrl() const;
 
             QNetworkAccessManager* nam() const;
+            /** Jobs of this connection go through it; see BaseJob::start() */
+            JobScheduler* scheduler() const;
             void setToken( QString token );
             void setHost( QString host );
             void setPort( int port );
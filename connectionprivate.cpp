@@ -20,16 +20,27 @@
 #include "connection.h"
 #include "state.h"
 #include "room.h"
+#include "timeline.h"
 #include "user.h"
 #include "jobs/passwordlogin.h"
 #include "jobs/syncjob.h"
 #include "jobs/joinroomjob.h"
 #include "jobs/roommembersjob.h"
+#include "jobs/postfilterjob.h"
 #include "events/event.h"
 #include "events/roommessageevent.h"
 #include "events/roommemberevent.h"
 
+#include <algorithm>
+
 #include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QUrl>
 #include <QtNetwork/QDnsLookup>
 
 using namespace QMatrixClient;
@@ -38,11 +49,31 @@ ConnectionPrivate::ConnectionPrivate(Connection* parent)
     : q(parent)
 {
     isConnected = false;
+    timelineBudget = 0;
     data = nullptr;
+    syncLoopRunning = false;
+    syncMode = Connection::SyncMode::Active;
+    syncTimeout = 30000;
+    idleSyncInterval = 60000;
+    syncFilter.setTimelineLimit(100);
+    filterJob = nullptr;
+    syncTimer.setSingleShot(true);
+    connect( &syncTimer, &QTimer::timeout, [this] () {
+        // If a sync is still in progress, the loop goes on when it's done
+        if( syncLoopRunning && syncJobs.isEmpty() )
+            nextSync(data->lastEvent());
+    });
 }
 
 ConnectionPrivate::~ConnectionPrivate()
 {
+    for( SyncJob* job: syncJobs )
+    {
+        dropDeferred(job);
+        if( !deferredResults.contains(job) )
+            job->kill();
+        job->deleteLater();
+    }
     delete data;
 }
 
@@ -85,12 +116,50 @@ void ConnectionPrivate::processState(State* state)
         r->addInitialState(state);
 }
 
-void ConnectionPrivate::processRooms(const QList<SyncRoomData>& data)
+void ConnectionPrivate::processRooms(QList<SyncRoomData>& data)
+{
+    for( SyncRoomData& roomData: data )
+        processRoom(roomData);
+}
+
+void ConnectionPrivate::processRoom(SyncRoomData& roomData)
 {
-    for( const SyncRoomData& roomData: data )
+    if ( Room* r = provideRoom(roomData.roomId) )
+        r->updateData(roomData);
+}
+
+// Each room keeps at least this many events regardless of the budget
+static const int MinTimelineSize = 20;
+
+static qint64 lastActivity(const Room* room)
+{
+    const Timeline& timeline = room->timeline();
+    return timeline.isEmpty() ? 0 : timeline.back()->timestampMsecs();
+}
+
+void ConnectionPrivate::enforceTimelineBudget()
+{
+    if( timelineBudget <= 0 )
+        return;
+
+    int total = 0;
+    for( Room* r: roomMap )
+        total += r->timeline().size();
+    if( total <= timelineBudget )
+        return;
+
+    // Rooms that have been quiet for the longest time go first
+    QList<Room*> rooms = roomMap.values();
+    std::sort(rooms.begin(), rooms.end(), [](const Room* r1, const Room* r2) {
+        return lastActivity(r1) < lastActivity(r2);
+    });
+    for( Room* r: rooms )
     {
-        if ( Room* r = provideRoom(roomData.roomId) )
-            r->updateData(roomData);
+        const int keep = std::max(MinTimelineSize,
+                                  r->timeline().size() - (total - timelineBudget));
+        total -= r->trimTimeline(keep);
+        if( total <= timelineBudget )
+            break;
     }
 }
 
@@ -115,6 +184,213 @@ Room* ConnectionPrivate::provideRoom(QString id)
     return room;
 }
 
+// The jobs retry on their own, so by the time one fails the server
+// has been in trouble for a while
+static const int SyncErrorPause = 30*1000;
+
+SyncJob* ConnectionPrivate::startSync(const QString& since, int timeout)
+{
+    SyncJob* job = new SyncJob(data, since);
+    // A job that has succeeded may wait in deferredResults for a while;
+    // sync jobs are deleted once they leave syncJobs
+    job->setAutoDelete(false);
+    job->setFilter(syncFilterParam());
+    job->setTimeout(timeout);
+    if( syncLoopRunning && syncMode == Connection::SyncMode::Idle )
+        job->setPresence("unavailable");
+    // Rooms are processed as they arrive, without waiting for the whole
+    // (potentially huge) response
+    job->setStreaming(true);
+    syncJobs.push_back(job);
+    connect( job, &SyncJob::roomDataReady, this, [=] (SyncRoomData& roomData) {
+        if( !syncJobs.isEmpty() && syncJobs.front() == job )
+            processRoom(roomData);
+        else
+        {
+            // The events now belong to deferredRooms
+            deferredRooms[job].push_back(roomData);
+            roomData.releaseEvents();
+        }
+    });
+    connect( job, &SyncJob::nextBatchReady, this, [=] (const QString& nextBatch) {
+        if( syncLoopRunning && syncMode == Connection::SyncMode::Active &&
+                !syncJobs.isEmpty() && syncJobs.back() == job )
+            nextSync(nextBatch);
+    });
+    connect( job, &SyncJob::success, this, [=] () {
+        if( !syncJobs.isEmpty() && syncJobs.front() == job )
+            finishSync(job);
+        else
+            deferredResults.insert(job);
+    });
+    connect( job, &SyncJob::failure, this, [=] () { failSync(job); });
+    job->start();
+    return job;
+}
+
+void ConnectionPrivate::nextSync(const QString& since)
+{
+    startSync(since, syncTimeout);
+}
+
+void ConnectionPrivate::finishSync(SyncJob* job)
+{
+    data->setLastEvent(job->nextBatch());
+    processRooms(job->roomData());
+    enforceTimelineBudget();
+    syncJobs.removeOne(job);
+    job->deleteLater();
+    emit q->syncDone();
+
+    if( !syncJobs.isEmpty() )
+    {
+        // The pipelined sync may have got something in the meantime
+        SyncJob* next = syncJobs.front();
+        QList<SyncRoomData> deferred = deferredRooms.take(next);
+        processRooms(deferred);
+        for( SyncRoomData& roomData: deferred )
+            roomData.deleteEvents();
+        if( deferredResults.remove(next) )
+            finishSync(next);
+        return;
+    }
+    if( syncLoopRunning && !syncTimer.isActive() )
+    {
+        if( syncMode == Connection::SyncMode::Idle )
+            syncTimer.start(idleSyncInterval);
+        else
+            nextSync(data->lastEvent());
+    }
+}
+
+void ConnectionPrivate::failSync(SyncJob* job)
+{
+    const int pos = syncJobs.indexOf(job);
+    if( pos == -1 )
+        return;
+    // Later syncs continue from the failed one, so they go too. The rooms
+    // that the failed job has applied come again with the next sync from
+    // lastEvent(); Room::updateData() doesn't apply the same data twice.
+    for( SyncJob* j: syncJobs.mid(pos) )
+    {
+        dropDeferred(j);
+        const bool finished = deferredResults.remove(j);
+        if( j != job && !finished )
+            j->kill();
+        j->deleteLater();
+    }
+    syncJobs.erase(syncJobs.begin() + pos, syncJobs.end());
+
+    if( job->filterRejected() )
+    {
+        // The id is of no use anymore; the next sync passes the filter
+        // inline and uploads it again
+        qWarning() << "The server doesn't know the sync filter"
+                   << syncFilterId << "anymore";
+        for( auto it = filterIds.begin(); it != filterIds.end(); )
+        {
+            if( it.value() == syncFilterId )
+                it = filterIds.erase(it);
+            else
+                ++it;
+        }
+        saveFilterIds();
+        syncFilterId.clear();
+    }
+    if( job->error() == BaseJob::ContentAccessError )
+    {
+        syncLoopRunning = false;
+        syncTimer.stop();
+        emit q->loginError(job->errorString());
+        return;
+    }
+    emit q->connectionError(job->errorString());
+    if( syncLoopRunning )
+        syncTimer.start(SyncErrorPause);
+}
+
+QString ConnectionPrivate::syncFilterParam()
+{
+    if( userId.isEmpty() )
+        return syncFilter.toJsonText();
+    if( filterIdsUserId != userId )
+    {
+        syncFilterId.clear();
+        loadFilterIds();
+    }
+    if( !syncFilterId.isEmpty() )
+        return syncFilterId;
+
+    const QString text = syncFilter.toJsonText();
+    syncFilterId = filterIds.value(text);
+    if( !syncFilterId.isEmpty() )
+        return syncFilterId;
+
+    if( !filterJob )
+    {
+        PostFilterJob* job = new PostFilterJob(data, userId, syncFilter);
+        const QString owner = userId;
+        connect( job, &PostFilterJob::success, [=] () {
+            if( filterIdsUserId != owner )
+                return;
+            filterIds.insert(text, job->filterId());
+            saveFilterIds();
+            // The filter may have been changed while uploading this one
+            if( syncFilter.toJsonText() == text )
+                syncFilterId = job->filterId();
+        });
+        connect( job, &PostFilterJob::result, [=] () { filterJob = nullptr; });
+        filterJob = job;
+        job->start();
+    }
+    return text;
+}
+
+QString ConnectionPrivate::filterCachePath() const
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+           "/filters/" + QString::fromLatin1(QUrl::toPercentEncoding(userId)) +
+           ".json";
+}
+
+void ConnectionPrivate::loadFilterIds()
+{
+    filterIds.clear();
+    filterIdsUserId = userId;
+    QFile file(filterCachePath());
+    if( !file.open(QFile::ReadOnly) )
+        return;
+    const QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+    for( auto it = json.begin(); it != json.end(); ++it )
+        filterIds.insert(it.key(), it.value().toString());
+    qDebug() << filterIds.size() << "filter id(s) loaded for" << userId;
+}
+
+void ConnectionPrivate::saveFilterIds() const
+{
+    QJsonObject json;
+    for( auto it = filterIds.begin(); it != filterIds.end(); ++it )
+        json.insert(it.key(), it.value());
+
+    const QString path = filterCachePath();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if( !file.open(QFile::WriteOnly) )
+    {
+        qWarning() << "Couldn't save filter ids to" << path << ":" << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(json).toJson());
+    if( !file.commit() )
+        qWarning() << "Couldn't save filter ids to" << path << ":" << file.errorString();
+}
+
+void ConnectionPrivate::dropDeferred(SyncJob* job)
+{
+    for( SyncRoomData& roomData: deferredRooms.take(job) )
+        roomData.deleteEvents();
+}
+
 //void ConnectionPrivate::connectDone(KJob* job)
 //{
 //    PasswordLogin* realJob = static_cast<PasswordLogin*>(job);
@@ -182,10 +458,7 @@ void ConnectionPrivate::gotRoomMembers(KJob* job)
     RoomMembersJob* membersJob = static_cast<RoomMembersJob*>(job);
     if( !membersJob->error() )
     {
-        for( State* state: membersJob->states() )
-        {
-            processState(state);
-        }
+        membersJob->room()->addInitialStates(membersJob->states());
         qDebug() << membersJob->states().count() << " processed...";
     }
     else
@@ -23,10 +23,13 @@ class KJob;
 
 #include <QtCore/QObject>
 #include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
 #include <QtCore/QJsonObject>
 
 #include "connection.h"
 #include "connectiondata.h"
+#include "filter.h"
 #include "jobs/syncjob.h"
 
 namespace QMatrixClient
@@ -35,6 +38,7 @@ namespace QMatrixClient
     class Event;
     class State;
     class User;
+    class PostFilterJob;
 
     class ConnectionPrivate : public QObject
     {
@@ -46,15 +50,69 @@ namespace QMatrixClient
             void resolveServer( QString domain );
 
             void processState( State* state );
-            void processRooms( const QList<SyncRoomData>& data );
+            /** Passes the events in data over to the rooms */
+            void processRooms( QList<SyncRoomData>& data );
+            void processRoom( SyncRoomData& roomData );
             /** Finds a room with this id or creates a new one and adds it to roomMap. */
             Room* provideRoom( QString id );
+            /** Trims rooms' timelines to fit into timelineBudget */
+            void enforceTimelineBudget();
+
+            /** Creates and starts a sync job; see syncJobs */
+            SyncJob* startSync(const QString& since, int timeout);
+            /** Starts the next sync of the loop */
+            void nextSync(const QString& since);
+            /**
+             * Applies the results of the first job in syncJobs, then
+             * whatever the next one has received in the meantime
+             */
+            void finishSync(SyncJob* job);
+            /** Drops the failed job and the ones that continue from it */
+            void failSync(SyncJob* job);
+            /** Forgets the rooms received by a job but not applied */
+            void dropDeferred(SyncJob* job);
+
+            /**
+             * What to pass to SyncJob::setFilter(): the id of syncFilter
+             * if it's known, or its JSON otherwise; in the latter case,
+             * uploads the filter to get the id for the next time
+             */
+            QString syncFilterParam();
+            /** Where filter ids of the current user are cached */
+            QString filterCachePath() const;
+            void loadFilterIds();
+            void saveFilterIds() const;
 
             Connection* q;
             ConnectionData* data;
             QHash<QString, Room*> roomMap;
             QHash<QString, User*> userMap;
             bool isConnected;
+            int timelineBudget;
+
+            bool syncLoopRunning;
+            Connection::SyncMode syncMode;
+            int syncTimeout;
+            int idleSyncInterval;
+            /** Fires the next sync of the loop after a pause */
+            QTimer syncTimer;
+            /**
+             * Sync jobs in progress, each one continuing from the previous
+             * one; only the results of the first one are applied right away
+             */
+            QList<SyncJob*> syncJobs;
+            /** Rooms received by a job that waits for the previous ones */
+            QHash<SyncJob*, QList<SyncRoomData>> deferredRooms;
+            /** Jobs that have succeeded but wait for the previous ones */
+            QSet<SyncJob*> deferredResults;
+
+            Filter syncFilter;
+            /** The id of syncFilter on the server, if known */
+            QString syncFilterId;
+            PostFilterJob* filterJob;
+            /** Filter ids by the JSON text of filters, for filterIdsUserId */
+            QHash<QString, QString> filterIds;
+            QString filterIdsUserId;
             QString username;
             QString password;
             QString userId;
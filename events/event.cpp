@@ -21,6 +21,10 @@
 #include <QtCore/QJsonArray>
 #include <QtCore/QJsonDocument>
 #include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QCborMap>
 #include <QtCore/QDebug>
 
 #include "../logging_util.h"
@@ -39,22 +43,29 @@ using namespace QMatrixClient;
 class Event::Private
 {
     public:
+        Private() : timestamp(0) {}
+
+        // The header fields come first and together, so that sorting and
+        // scanning the timeline touches as little memory as possible
         EventType type;
+        qint64 timestamp;
         QString id;
-        QDateTime timestamp;
         QString roomId;
-        QString originalJson;
+        QCborMap originalJson;
 };
 
+// Events are created in the thread pool as well
+static QAtomicInt keepOriginalJson(0);
+
 Event::Event(EventType type)
-    : d(new Private)
+    : d(dStorage.create<Private>())
 {
     d->type = type;
 }
 
 Event::~Event()
 {
-    delete d;
+    d->~Private();
 }
 
 EventType Event::type() const
@@ -68,6 +79,12 @@ QString Event::id() const
 }
 
 QDateTime Event::timestamp() const
+{
+    return d->timestamp ? QDateTime::fromMSecsSinceEpoch(d->timestamp, Qt::UTC)
+                      : QDateTime();
+}
+
+qint64 Event::timestampMsecs() const
 {
     return d->timestamp;
 }
@@ -77,52 +94,98 @@ QString Event::roomId() const
     return d->roomId;
 }
 
+QJsonObject Event::originalJsonObject() const
+{
+    return d->originalJson.toJsonObject();
+}
+
 QString Event::originalJson() const
 {
-    return d->originalJson;
+    if( d->originalJson.isEmpty() )
+        return QString();
+    return QString::fromUtf8(
+        QJsonDocument(originalJsonObject()).toJson(QJsonDocument::Compact));
 }
 
-Event* Event::fromJson(const QJsonObject& obj)
+void Event::setKeepOriginalJson(bool keep)
 {
-    //qDebug() << obj.value("type").toString();
-    if( obj.value("type").toString() == "m.room.message" )
-    {
-        return RoomMessageEvent::fromJson(obj);
-    }
-    if( obj.value("type").toString() == "m.room.name" )
-    {
-        return RoomNameEvent::fromJson(obj);
-    }
-    if( obj.value("type").toString() == "m.room.aliases" )
-    {
-        return RoomAliasesEvent::fromJson(obj);
-    }
-    if( obj.value("type").toString() == "m.room.canonical_alias" )
-    {
-        return RoomCanonicalAliasEvent::fromJson(obj);
-    }
-    if( obj.value("type").toString() == "m.room.member" )
+    keepOriginalJson.storeRelease(keep ? 1 : 0);
+}
+
+bool Event::keepsOriginalJson()
+{
+    return keepOriginalJson.loadAcquire() != 0;
+}
+
+namespace
+{
+    template <class EventT>
+    Event* makeEvent(const QJsonObject& obj)
     {
-        return RoomMemberEvent::fromJson(obj);
+        return EventT::fromJson(obj);
     }
-    if( obj.value("type").toString() == "m.room.topic" )
+
+    const struct { const char* type; event_factory_t factory; } builtInEventTypes[]
     {
-        return RoomTopicEvent::fromJson(obj);
-    }
-    if( obj.value("type").toString() == "m.typing" )
+        { "m.room.message", makeEvent<RoomMessageEvent> },
+        { "m.room.name", makeEvent<RoomNameEvent> },
+        { "m.room.aliases", makeEvent<RoomAliasesEvent> },
+        { "m.room.canonical_alias", makeEvent<RoomCanonicalAliasEvent> },
+        { "m.room.member", makeEvent<RoomMemberEvent> },
+        { "m.room.topic", makeEvent<RoomTopicEvent> },
+        { "m.typing", makeEvent<TypingEvent> },
+        { "m.receipt", makeEvent<ReceiptEvent> }
+    };
+
+    class EventTypeRegistry
     {
-        return TypingEvent::fromJson(obj);
-    }
-    if( obj.value("type").toString() == "m.receipt" )
+        public:
+            EventTypeRegistry()
+            {
+                for (auto t: builtInEventTypes)
+                    factories.insert(t.type, t.factory);
+            }
+
+            event_factory_t factory(const QString& type) const
+            {
+                QReadLocker locker(&lock);
+                return factories.value(type, nullptr);
+            }
+
+            void add(const QString& type, event_factory_t factory)
+            {
+                QWriteLocker locker(&lock);
+                factories.insert(type, factory);
+            }
+
+        private:
+            mutable QReadWriteLock lock;
+            QHash<QString, event_factory_t> factories;
+    };
+
+    EventTypeRegistry& registry()
     {
-        return ReceiptEvent::fromJson(obj);
+        static EventTypeRegistry r;
+        return r;
     }
+}
+
+Event* Event::fromJson(const QJsonObject& obj)
+{
+    if (event_factory_t factory = registry().factory(obj.value("type").toString()))
+        return factory(obj);
     return UnknownEvent::fromJson(obj);
 }
 
+void Event::registerEventType(const QString& type, event_factory_t factory)
+{
+    registry().add(type, factory);
+}
+
 bool Event::parseJson(const QJsonObject& obj)
 {
-    d->originalJson = QString::fromUtf8(QJsonDocument(obj).toJson());
+    if( keepsOriginalJson() )
+        d->originalJson = QCborMap::fromJsonObject(obj);
     bool correct = (d->type != EventType::Unknown);
     if ( d->type != EventType::Unknown && d->type != EventType::Typing )
     {
@@ -136,8 +199,7 @@ bool Event::parseJson(const QJsonObject& obj)
         }
         if( obj.contains("origin_server_ts") )
         {
-            d->timestamp = QDateTime::fromMSecsSinceEpoch( 
-                static_cast<qint64>(obj.value("origin_server_ts").toDouble()), Qt::UTC );
+            d->timestamp = static_cast<qint64>(obj.value("origin_server_ts").toDouble());
         } else {
             correct = false;
             qDebug() << "Event: can't find ts";
@@ -156,6 +218,17 @@ QList<Event*> QMatrixClient::eventListFromJson(const QJsonArray& json)
     QList<Event*> l;
     l.reserve(json.size());
     for (auto event: json)
-        l.push_back(Event::fromJson(event.toObject()));
+    {
+        const QJsonObject obj = event.toObject();
+        if (!obj.contains("state_key"))
+        {
+            l.push_back(Event::fromJson(obj));
+            continue;
+        }
+        // A state event may stay the current state of its room long after
+        // the rest of the batch is gone; it shouldn't keep the arena alive.
+        EventArena::Scope heapOnly(nullptr);
+        l.push_back(Event::fromJson(obj));
+    }
     return l;
 }
@@ -20,11 +20,15 @@
 #define QMATRIXCLIENT_EVENT_H
 
 #include <algorithm>
+#include <cstddef>
+#include <new>
 
 #include <QtCore/QString>
 #include <QtCore/QDateTime>
 #include <QtCore/QJsonObject>
 
+#include "eventarena.h"
+
 class QJsonArray;
 
 namespace QMatrixClient
@@ -35,26 +39,106 @@ namespace QMatrixClient
         RoomMember, RoomTopic, Typing, Receipt, Unknown
     };
     
-    class Event
+    class Event;
+    typedef Event* (*event_factory_t)(const QJsonObject& obj);
+
+    /**
+     * @brief Space for the Private of an event class inside the event itself
+     *
+     * Event classes keep their data in a Private class, like the rest of
+     * the library, but construct it in place in this buffer instead of on
+     * the heap; an event is then a single allocation, with its fields next
+     * to each other. The size of the buffer is a part of the ABI. It is
+     * bigger than each Private needs now, so that fields can be added
+     * without changing the layout of the class; create() won't compile
+     * once a Private outgrows its buffer. The buffer has to be declared
+     * before the d pointer, so that it's there when d is initialized.
+     */
+    template <std::size_t Words>
+    class InlineStorage
     {
+        public:
+            InlineStorage() { }
+
+            template <typename PrivateT>
+            PrivateT* create()
+            {
+                static_assert(sizeof(PrivateT) <= sizeof(buffer),
+                              "Private doesn't fit into the reserved space");
+                static_assert(alignof(PrivateT) <= Alignment,
+                              "Private needs a stricter alignment");
+                return new (buffer) PrivateT;
+            }
+
+        private:
+            static const std::size_t Alignment = 8;
+            alignas(Alignment) char buffer[Words * Alignment];
+    };
+
+    class Event: public ArenaAllocated
+    {
+            Q_DISABLE_COPY(Event)
         public:
             Event(EventType type);
             virtual ~Event();
             
             EventType type() const;
             QString id() const;
+            /** Built from timestampMsecs() on each call */
             QDateTime timestamp() const;
+            /**
+             * The origin_server_ts of the event, in milliseconds since
+             * the epoch (UTC); 0 for events that don't have it. Prefer this
+             * to timestamp() for comparisons.
+             */
+            qint64 timestampMsecs() const;
             QString roomId() const;
-            // only for debug purposes!
+            /**
+             * The JSON the event was made from; empty unless the event was
+             * created with setKeepOriginalJson() on.
+             */
+            QJsonObject originalJsonObject() const;
+            /** The same as originalJsonObject(), rendered on each call */
             QString originalJson() const;
 
+            /**
+             * @brief Whether events created from now on keep their JSON
+             *
+             * Off by default: most applications never look at the source
+             * of events, and keeping it costs memory for every event.
+             * Connection::saveState() and the event store need it, so
+             * Connection::loadState() and Room::loadHistory() turn it on.
+             * The JSON is kept as a QCborMap, which shares the data with
+             * the source object on Qt 5.15 and is a copy of the event alone
+             * on earlier versions; it never keeps the whole source document
+             * alive. Can be called from any thread.
+             */
+            static void setKeepOriginalJson(bool keep);
+            static bool keepsOriginalJson();
+
+            /**
+             * Creates an event of the class registered for the event type
+             * in the JSON, or an UnknownEvent if there's none.
+             */
             static Event* fromJson(const QJsonObject& obj);
-            
+            /**
+             * @brief Registers a factory for events of a given type
+             *
+             * Allows applications to have their own event classes without
+             * patching the library; a factory registered for one of
+             * the built-in types replaces the built-in one. Can be called
+             * from any thread, but events of this type that are being
+             * decoded at the same time may still come out the old way.
+             */
+            static void registerEventType(const QString& type,
+                                          event_factory_t factory);
+
         protected:
             bool parseJson(const QJsonObject& obj);
         
         private:
             class Private;
+            InlineStorage<8> dStorage;
             Private* d;
     };
 
@@ -71,7 +155,7 @@ namespace QMatrixClient
     {
         return std::lower_bound (timeline.begin(), timeline.end(), item,
             [](const ItemT * a, const ItemT * b) {
-                return a->timestamp() < b->timestamp();
+                return a->timestampMsecs() < b->timestampMsecs();
             }
         );
     }
@@ -0,0 +1,115 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "eventarena.h"
+
+#include <new>
+
+using namespace QMatrixClient;
+
+// Enough to keep whatever follows the header aligned for any type
+static const std::size_t Alignment = 16;
+static const std::size_t BlockSize = 64 * 1024;
+
+static thread_local EventArena* currentArena = nullptr;
+
+static std::size_t aligned(std::size_t size)
+{
+    return (size + Alignment - 1) & ~(Alignment - 1);
+}
+
+EventArena::EventArena()
+    : refs(1), next(nullptr), left(0)
+{
+}
+
+EventArena::~EventArena()
+{
+    for( char* block: blocks )
+        ::operator delete(block);
+}
+
+void* EventArena::allocate(std::size_t size)
+{
+    size = aligned(size);
+    refs.ref();
+    if( size > BlockSize / 4 )
+    {
+        // Don't waste the rest of the current block on a big object
+        char* block = static_cast<char*>(::operator new(size));
+        blocks.push_back(block);
+        return block;
+    }
+    if( size > left )
+    {
+        next = static_cast<char*>(::operator new(BlockSize));
+        blocks.push_back(next);
+        left = BlockSize;
+    }
+    void* result = next;
+    next += size;
+    left -= size;
+    return result;
+}
+
+void EventArena::release()
+{
+    if( !refs.deref() )
+        delete this;
+}
+
+EventArena* EventArena::current()
+{
+    return currentArena;
+}
+
+EventArena::Scope::Scope(EventArena* arena)
+    : previous(currentArena)
+{
+    currentArena = arena;
+}
+
+EventArena::Scope::~Scope()
+{
+    currentArena = previous;
+}
+
+// Each object is preceded by a header pointing to its arena (nullptr for
+// objects on the heap), so that operator delete knows what to do.
+static const std::size_t HeaderSize = aligned(sizeof(EventArena*));
+
+void* ArenaAllocated::operator new(std::size_t size)
+{
+    EventArena* arena = EventArena::current();
+    char* block = static_cast<char*>(arena ? arena->allocate(HeaderSize + size)
+                                           : ::operator new(HeaderSize + size));
+    *reinterpret_cast<EventArena**>(block) = arena;
+    return block + HeaderSize;
+}
+
+void ArenaAllocated::operator delete(void* ptr)
+{
+    if( !ptr )
+        return;
+
+    char* block = static_cast<char*>(ptr) - HeaderSize;
+    if( EventArena* arena = *reinterpret_cast<EventArena**>(block) )
+        arena->release();
+    else
+        ::operator delete(block);
+}
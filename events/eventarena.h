@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef QMATRIXCLIENT_EVENTARENA_H
+#define QMATRIXCLIENT_EVENTARENA_H
+
+#include <cstddef>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QVector>
+
+namespace QMatrixClient
+{
+    /**
+     * @brief A bump allocator for events decoded in one batch
+     *
+     * While an EventArena::Scope is alive, all objects derived from
+     * ArenaAllocated that are created in the same thread take their memory
+     * from the arena; there's no per-object heap allocation.
+     *
+     * The arena is reference-counted: the creator holds one reference and
+     * each object allocated from it holds another one. Deleting an object
+     * runs its destructor as usual but only drops the reference; the memory
+     * of the whole arena is freed at once when the last object is gone.
+     * Hence the ownership passes to whoever owns the events (normally,
+     * a Room) as soon as the creator calls release(). Any single event that
+     * lives on keeps the whole arena, so events that may outlive the rest
+     * of their batch (state events) should be created outside of it.
+     *
+     * Allocation is not thread-safe - only one thread at a time may have
+     * a Scope for a given arena; objects may be deleted from any thread.
+     */
+    class EventArena
+    {
+        public:
+            EventArena();
+
+            void* allocate(std::size_t size);
+            /** Drops a reference; the last one deletes the arena */
+            void release();
+
+            /** The arena used in the current thread, or nullptr */
+            static EventArena* current();
+
+            class Scope
+            {
+                public:
+                    explicit Scope(EventArena* arena);
+                    ~Scope();
+
+                private:
+                    EventArena* previous;
+            };
+
+        private:
+            ~EventArena();
+
+            QAtomicInt refs;
+            QVector<char*> blocks;
+            char* next;
+            std::size_t left;
+    };
+
+    /**
+     * @brief A base for classes that can be allocated in an EventArena
+     *
+     * Outside of an EventArena::Scope, objects are allocated on the heap
+     * as usual.
+     */
+    class ArenaAllocated
+    {
+        public:
+            static void* operator new(std::size_t size);
+            static void operator delete(void* ptr);
+    };
+}
+
+#endif // QMATRIXCLIENT_EVENTARENA_H
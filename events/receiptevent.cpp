@@ -41,6 +41,12 @@ Example of a Receipt Event:
 
 using namespace QMatrixClient;
 
+class ReceiptEvent::Private
+{
+    public:
+        QHash<QString, QList<Receipt>> eventToReceipts;
+};
+
 Receipt::Receipt(QString event, QString user, QDateTime time)
     : eventId(event)
     , userId(user)
@@ -48,21 +54,15 @@ Receipt::Receipt(QString event, QString user, QDateTime time)
 {
 }
 
-class ReceiptEvent::Private
-{
-    public:
-        QHash<QString, QList<Receipt>> eventToReceipts;
-};
-
 ReceiptEvent::ReceiptEvent()
     : Event(EventType::Receipt)
-    , d(new Private)
+    , d(dStorage.create<Private>())
 {
 }
 
 ReceiptEvent::~ReceiptEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 QList<Receipt> ReceiptEvent::receiptsForEvent(QString eventId) const
@@ -77,6 +77,8 @@ QStringList ReceiptEvent::events() const
 
 ReceiptEvent* ReceiptEvent::fromJson(const QJsonObject& obj)
 {
+    // Room::processEphemeralEvent() asks for all receipts right away,
+    // so there's nothing to gain from decoding them lazily
     ReceiptEvent* e = new ReceiptEvent();
     e->parseJson(obj);
     const QJsonObject contents = obj.value("content").toObject();
@@ -22,6 +22,7 @@
 #include "event.h"
 
 #include <QtCore/QStringList>
+#include <QtCore/QHash>
 
 namespace QMatrixClient
 {
@@ -49,6 +50,7 @@ namespace QMatrixClient
 
         private:
             class Private;
+            InlineStorage<4> dStorage;
             Private* d;
     };
 }
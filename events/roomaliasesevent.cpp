@@ -48,13 +48,13 @@ class RoomAliasesEvent::Private
 
 RoomAliasesEvent::RoomAliasesEvent()
     : Event(EventType::RoomAliases)
-    , d(new Private)
+    , d(dStorage.create<Private>())
 {
 }
 
 RoomAliasesEvent::~RoomAliasesEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 QStringList RoomAliasesEvent::aliases() const
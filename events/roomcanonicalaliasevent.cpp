@@ -28,13 +28,13 @@ class RoomCanonicalAliasEvent::Private
 
 RoomCanonicalAliasEvent::RoomCanonicalAliasEvent()
     : Event(EventType::RoomCanonicalAlias)
-    , d(new Private)
+    , d(dStorage.create<Private>())
 {
 }
 
 RoomCanonicalAliasEvent::~RoomCanonicalAliasEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 QString RoomCanonicalAliasEvent::alias()
@@ -35,6 +35,7 @@ namespace QMatrixClient
 
         private:
             class Private;
+            InlineStorage<4> dStorage;
             Private* d;
     };
 }
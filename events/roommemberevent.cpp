@@ -34,13 +34,13 @@ class RoomMemberEvent::Private
 
 RoomMemberEvent::RoomMemberEvent()
     : Event(EventType::RoomMember)
-    , d(new Private)
+    , d(dStorage.create<Private>())
 {
 }
 
 RoomMemberEvent::~RoomMemberEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 MembershipType RoomMemberEvent::membership() const
@@ -43,6 +43,7 @@ namespace QMatrixClient
 
         private:
             class Private;
+            InlineStorage<8> dStorage;
             Private* d;
     };
 }
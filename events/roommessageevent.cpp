@@ -19,6 +19,7 @@
 #include "roommessageevent.h"
 
 #include <QtCore/QJsonObject>
+#include <QtCore/QCborMap>
 #include <QtCore/QDateTime>
 #include <QtCore/QDebug>
 
@@ -27,24 +28,26 @@ using namespace QMatrixClient;
 class RoomMessageEvent::Private
 {
     public:
-        Private() {}
-        
+        Private() : msgtype(MessageEventType::Unkown), content(nullptr) {}
+
         QString userId;
-        MessageEventType msgtype;
         QDateTime hsob_ts;
+        MessageEventType msgtype;
         MessageEventContent* content;
+        /** The content JSON until it's decoded; see parseContent() */
+        QCborMap contentSource;
 };
 
 RoomMessageEvent::RoomMessageEvent()
     : Event(EventType::RoomMessage)
-    , d(new Private)
+    , d(dStorage.create<Private>())
 {
-    d->content = nullptr;
 }
 
 RoomMessageEvent::~RoomMessageEvent()
 {
-    delete d;
+    delete d->content;
+    d->~Private();
 }
 
 QString RoomMessageEvent::userId() const
@@ -54,11 +57,13 @@ QString RoomMessageEvent::userId() const
 
 MessageEventType RoomMessageEvent::msgtype() const
 {
+    parseContent();
     return d->msgtype;
 }
 
 QString RoomMessageEvent::body() const
 {
+    parseContent();
     return d->content->body;
 }
 
@@ -69,122 +74,125 @@ QDateTime RoomMessageEvent::hsob_ts() const
 
 MessageEventContent* RoomMessageEvent::content() const
 {
-        return d->content;
+    parseContent();
+    return d->content;
 }
 
 RoomMessageEvent* RoomMessageEvent::fromJson(const QJsonObject& obj)
 {
     RoomMessageEvent* e = new RoomMessageEvent();
     e->parseJson(obj);
+    e->d->contentSource =
+        QCborMap::fromJsonObject(obj.value("content").toObject());
     if( obj.contains("sender") )
     {
         e->d->userId = obj.value("sender").toString();
     } else {
         qDebug() << "RoomMessageEvent: user_id not found";
     }
-    if( obj.contains("content") )
+    return e;
+}
+
+void RoomMessageEvent::parseContent() const
+{
+    if( d->content )
+        return;
+
+    const QJsonObject contentJson = d->contentSource.toJsonObject();
+    d->contentSource = QCborMap();
+    const QString msgtypeString = contentJson.value("msgtype").toString();
+    if( msgtypeString == "m.text" )
     {
-        QJsonObject content = obj.value("content").toObject();
-        QString msgtype = content.value("msgtype").toString();
-
-        if( msgtype == "m.text" )
-        {
-            e->d->msgtype = MessageEventType::Text;
-            e->d->content = new MessageEventContent();
-        }
-        else if( msgtype == "m.emote" )
-        {
-            e->d->msgtype = MessageEventType::Emote;
-            e->d->content = new MessageEventContent();
-        }
-        else if( msgtype == "m.notice" )
-        {
-            e->d->msgtype = MessageEventType::Notice;
-            e->d->content = new MessageEventContent();
-        }
-        else if( msgtype == "m.image" )
-        {
-            e->d->msgtype = MessageEventType::Image;
-            ImageEventContent* c = new ImageEventContent;
-            c->url = QUrl(content.value("url").toString());
-            QJsonObject info = content.value("info").toObject();
-            c->height = info.value("h").toInt();
-            c->width = info.value("w").toInt();
-            c->size = info.value("size").toInt();
-            c->mimetype = info.value("mimetype").toString();
-            e->d->content = c;
-        }
-        else if( msgtype == "m.file" )
-        {
-            e->d->msgtype = MessageEventType::File;
-            FileEventContent* c = new FileEventContent;
-            c->filename = content.value("filename").toString();
-            c->url = QUrl(content.value("url").toString());
-            QJsonObject info = content.value("info").toObject();
-            c->size = info.value("size").toInt();
-            c->mimetype = info.value("mimetype").toString();
-            e->d->content = c;
-        }
-        else if( msgtype == "m.location" )
-        {
-            e->d->msgtype = MessageEventType::Location;
-            LocationEventContent* c = new LocationEventContent;
-            c->geoUri = content.value("geo_uri").toString();
-            c->thumbnailUrl = QUrl(content.value("thumbnail_url").toString());
-            QJsonObject info = content.value("thumbnail_info").toObject();
-            c->thumbnailHeight = info.value("h").toInt();
-            c->thumbnailWidth = info.value("w").toInt();
-            c->thumbnailSize = info.value("size").toInt();
-            c->thumbnailMimetype = info.value("mimetype").toString();
-            e->d->content = c;
-        }
-        else if( msgtype == "m.video" )
-        {
-            e->d->msgtype = MessageEventType::Video;
-            VideoEventContent* c = new VideoEventContent;
-            c->url = QUrl(content.value("url").toString());
-            QJsonObject info = content.value("info").toObject();
-            c->height = info.value("h").toInt();
-            c->width = info.value("w").toInt();
-            c->duration = info.value("duration").toInt();
-            c->size = info.value("size").toInt();
-            c->thumbnailUrl = QUrl(info.value("thumnail_url").toString());
-            QJsonObject thumbnailInfo = content.value("thumbnail_info").toObject();
-            c->thumbnailHeight = thumbnailInfo.value("h").toInt();
-            c->thumbnailWidth = thumbnailInfo.value("w").toInt();
-            c->thumbnailSize = thumbnailInfo.value("size").toInt();
-            c->thumbnailMimetype = thumbnailInfo.value("mimetype").toString();
-            e->d->content = c;
-        }
-        else if( msgtype == "m.audio" )
-        {
-            e->d->msgtype = MessageEventType::Audio;
-            AudioEventContent* c = new AudioEventContent;
-            c->url = QUrl(content.value("url").toString());
-            QJsonObject info = content.value("info").toObject();
-            c->duration = info.value("duration").toInt();
-            c->mimetype = info.value("mimetype").toString();
-            c->size = info.value("size").toInt();
-            e->d->content = c;
-        }
-        else
-        {
-            qDebug() << "RoomMessageEvent: unknown msgtype: " << msgtype;
-            qDebug() << obj;
-            e->d->msgtype = MessageEventType::Unkown;
-            e->d->content = new MessageEventContent;
-        }
-
-        if( content.contains("body") )
-        {
-            e->d->content->body = content.value("body").toString();
-        } else {
-            qDebug() << "RoomMessageEvent: body not found";
-        }
-//             e->d->hsob_ts = QDateTime::fromMSecsSinceEpoch( content.value("hsoc_ts").toInt() );
-//         } else {
-//             qDebug() << "RoomMessageEvent: hsoc_ts not found";
-//         }
+        d->msgtype = MessageEventType::Text;
+        d->content = new MessageEventContent();
+    }
+    else if( msgtypeString == "m.emote" )
+    {
+        d->msgtype = MessageEventType::Emote;
+        d->content = new MessageEventContent();
+    }
+    else if( msgtypeString == "m.notice" )
+    {
+        d->msgtype = MessageEventType::Notice;
+        d->content = new MessageEventContent();
+    }
+    else if( msgtypeString == "m.image" )
+    {
+        d->msgtype = MessageEventType::Image;
+        ImageEventContent* c = new ImageEventContent;
+        c->url = QUrl(contentJson.value("url").toString());
+        QJsonObject info = contentJson.value("info").toObject();
+        c->height = info.value("h").toInt();
+        c->width = info.value("w").toInt();
+        c->size = info.value("size").toInt();
+        c->mimetype = info.value("mimetype").toString();
+        d->content = c;
+    }
+    else if( msgtypeString == "m.file" )
+    {
+        d->msgtype = MessageEventType::File;
+        FileEventContent* c = new FileEventContent;
+        c->filename = contentJson.value("filename").toString();
+        c->url = QUrl(contentJson.value("url").toString());
+        QJsonObject info = contentJson.value("info").toObject();
+        c->size = info.value("size").toInt();
+        c->mimetype = info.value("mimetype").toString();
+        d->content = c;
+    }
+    else if( msgtypeString == "m.location" )
+    {
+        d->msgtype = MessageEventType::Location;
+        LocationEventContent* c = new LocationEventContent;
+        c->geoUri = contentJson.value("geo_uri").toString();
+        c->thumbnailUrl = QUrl(contentJson.value("thumbnail_url").toString());
+        QJsonObject info = contentJson.value("thumbnail_info").toObject();
+        c->thumbnailHeight = info.value("h").toInt();
+        c->thumbnailWidth = info.value("w").toInt();
+        c->thumbnailSize = info.value("size").toInt();
+        c->thumbnailMimetype = info.value("mimetype").toString();
+        d->content = c;
+    }
+    else if( msgtypeString == "m.video" )
+    {
+        d->msgtype = MessageEventType::Video;
+        VideoEventContent* c = new VideoEventContent;
+        c->url = QUrl(contentJson.value("url").toString());
+        QJsonObject info = contentJson.value("info").toObject();
+        c->height = info.value("h").toInt();
+        c->width = info.value("w").toInt();
+        c->duration = info.value("duration").toInt();
+        c->size = info.value("size").toInt();
+        c->thumbnailUrl = QUrl(info.value("thumnail_url").toString());
+        QJsonObject thumbnailInfo = contentJson.value("thumbnail_info").toObject();
+        c->thumbnailHeight = thumbnailInfo.value("h").toInt();
+        c->thumbnailWidth = thumbnailInfo.value("w").toInt();
+        c->thumbnailSize = thumbnailInfo.value("size").toInt();
+        c->thumbnailMimetype = thumbnailInfo.value("mimetype").toString();
+        d->content = c;
+    }
+    else if( msgtypeString == "m.audio" )
+    {
+        d->msgtype = MessageEventType::Audio;
+        AudioEventContent* c = new AudioEventContent;
+        c->url = QUrl(contentJson.value("url").toString());
+        QJsonObject info = contentJson.value("info").toObject();
+        c->duration = info.value("duration").toInt();
+        c->mimetype = info.value("mimetype").toString();
+        c->size = info.value("size").toInt();
+        d->content = c;
+    }
+    else
+    {
+        qDebug() << "RoomMessageEvent: unknown msgtype: " << msgtypeString;
+        qDebug() << contentJson;
+        d->msgtype = MessageEventType::Unkown;
+        d->content = new MessageEventContent;
+    }
+
+    if( contentJson.contains("body") )
+    {
+        d->content->body = contentJson.value("body").toString();
+    } else {
+        qDebug() << "RoomMessageEvent: body not found";
     }
-    return e;
 }
@@ -30,7 +30,7 @@ namespace QMatrixClient
         Text, Emote, Notice, Image, File, Location, Video, Audio, Unkown
     };
 
-    class MessageEventContent
+    class MessageEventContent: public ArenaAllocated
     {
         public:
             virtual ~MessageEventContent() {}
@@ -54,7 +54,18 @@ namespace QMatrixClient
             static RoomMessageEvent* fromJson( const QJsonObject& obj );
             
         private:
+            /**
+             * Decodes the content on the first call; the content of most
+             * events is never looked at (scrolled-off timeline, ephemeral
+             * rooms), so there's no point in decoding it upfront. Until
+             * then, the event keeps the content JSON as a QCborMap, which
+             * shares the data with the source object on Qt 5.15 and is
+             * a copy of the content alone on earlier versions.
+             */
+            void parseContent() const;
+
             class Private;
+            InlineStorage<8> dStorage;
             Private* d;
     };
 
@@ -28,13 +28,13 @@ public:
 
 RoomNameEvent::RoomNameEvent() :
     Event(EventType::RoomName),
-    d(new Private)
+    d(dStorage.create<Private>())
 {
 }
 
 RoomNameEvent::~RoomNameEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 QString RoomNameEvent::name() const
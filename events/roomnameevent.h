@@ -36,7 +36,8 @@ public:
 
 private:
     class Private;
-    Private *d;
+    InlineStorage<4> dStorage;
+    Private* d;
 };
 
 }
@@ -28,13 +28,13 @@ class RoomTopicEvent::Private
 
 RoomTopicEvent::RoomTopicEvent()
     : Event(EventType::RoomTopic)
-    , d(new Private)
+    , d(dStorage.create<Private>())
 {
 }
 
 RoomTopicEvent::~RoomTopicEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 QString RoomTopicEvent::topic() const
@@ -31,13 +31,13 @@ class TypingEvent::Private
 
 TypingEvent::TypingEvent()
     : Event(EventType::Typing)
-    , d( new Private )
+    , d(dStorage.create<Private>())
 {
 }
 
 TypingEvent::~TypingEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 QStringList TypingEvent::users()
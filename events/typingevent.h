@@ -37,6 +37,7 @@ namespace QMatrixClient
 
         private:
             class Private;
+            InlineStorage<4> dStorage;
             Private* d;
     };
 }
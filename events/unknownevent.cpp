@@ -19,6 +19,7 @@
 #include "unknownevent.h"
 
 #include <QtCore/QJsonDocument>
+#include <QtCore/QCborMap>
 #include <QtCore/QDebug>
 
 #include "../logging_util.h"
@@ -29,18 +30,19 @@ class UnknownEvent::Private
 {
     public:
         QString type;
-        QString content;
+        /** The whole event is its content; see Event::setKeepOriginalJson() */
+        QCborMap json;
 };
 
 UnknownEvent::UnknownEvent()
     : Event(EventType::Unknown)
-    , d(new Private)
+    , d(dStorage.create<Private>())
 {
 }
 
 UnknownEvent::~UnknownEvent()
 {
-    delete d;
+    d->~Private();
 }
 
 QString UnknownEvent::typeString() const
@@ -50,7 +52,7 @@ QString UnknownEvent::typeString() const
 
 QString UnknownEvent::content() const
 {
-    return d->content;
+    return QString::fromUtf8(QJsonDocument(d->json.toJsonObject()).toJson());
 }
 
 UnknownEvent* UnknownEvent::fromJson(const QJsonObject& obj)
@@ -58,7 +60,7 @@ UnknownEvent* UnknownEvent::fromJson(const QJsonObject& obj)
     UnknownEvent* e = new UnknownEvent();
     e->parseJson(obj);
     e->d->type = obj.value("type").toString();
-    e->d->content = QString::fromUtf8(QJsonDocument(obj).toJson());
+    e->d->json = QCborMap::fromJsonObject(obj);
     qDebug() << "UnknownEvent, JSON follows:";
     qDebug() << formatJson << obj;
     return e;
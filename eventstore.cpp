@@ -0,0 +1,455 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "eventstore.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+#include <QtCore/QCborValue>
+#include <QtCore/QCborMap>
+#include <QtCore/QJsonObject>
+#include <QtCore/QDebug>
+
+#include "events/event.h"
+#include "timeline.h"
+
+using namespace QMatrixClient;
+
+namespace
+{
+    const char Magic[4] = { 'Q', 'M', 'E', 'S' };
+    const quint32 FormatVersion = 3;
+    // Catches files written on a machine with a different byte order
+    const quint32 ByteOrderMark = 0x01020304;
+
+    struct Header
+    {
+        char magic[4];
+        quint32 byteOrder;
+        quint32 version;
+        quint32 reserved;
+    };
+
+    // All offsets are in bytes from the start of the file; string lengths
+    // are in QChars
+    struct Entry
+    {
+        qint64 timestamp;
+        quint32 type;
+        quint32 idLength;
+        quint64 idOffset;
+        quint64 senderOffset;
+        quint32 senderLength;
+        quint32 payloadSize;
+        quint64 payloadOffset;
+    };
+
+    // Comes last, so that a file cut short by a failed write doesn't end
+    // with a valid footer
+    struct Footer
+    {
+        quint64 indexOffset;
+        quint32 count;
+        quint32 prevBatchLength;
+        quint64 prevBatchOffset;
+        quint32 reserved;
+        char magic[4];
+    };
+
+    typedef QPair<quint64, quint32> string_ref_t;
+
+    /** Appends zero bytes to make the size a multiple of alignment */
+    void align(QByteArray& data, int alignment)
+    {
+        data.append(QByteArray((alignment - data.size() % alignment) % alignment, '\0'));
+    }
+
+    /**
+     * Lays out a block of strings and event payloads that goes to the file
+     * at a given offset, followed by the index and the footer
+     */
+    class Builder
+    {
+        public:
+            explicit Builder(quint64 base)
+                : base(base)
+            { }
+
+            void add(const Event* e)
+            {
+                const QJsonObject json = e->originalJsonObject();
+                if( json.isEmpty() )
+                {
+                    qWarning() << "EventStore: event" << e->id()
+                               << "has no original JSON to save";
+                    return;
+                }
+                const QByteArray eventData = QCborValue::fromJsonValue(json).toCbor();
+
+                Entry entry;
+                entry.timestamp = e->timestampMsecs();
+                entry.type = quint32(e->type());
+                const string_ref_t idRef = intern(e->id());
+                entry.idOffset = idRef.first;
+                entry.idLength = idRef.second;
+                const string_ref_t senderRef = intern(json.value("sender").toString());
+                entry.senderOffset = senderRef.first;
+                entry.senderLength = senderRef.second;
+                // Relative to the payload blob until finish()
+                entry.payloadOffset = payload.size();
+                entry.payloadSize = eventData.size();
+                payload.append(eventData);
+                entries.push_back(entry);
+            }
+
+            /**
+             * Returns the block, the index of the stored entries (if any)
+             * and the new ones, and the footer
+             */
+            QByteArray finish(const QVector<Entry>& storedEntries,
+                              string_ref_t prevBatchRef)
+            {
+                QByteArray data = strings;
+                align(data, 8);
+                const quint64 payloadBase = base + data.size();
+                data.append(payload);
+                align(data, 8);
+
+                Footer footer;
+                footer.indexOffset = base + data.size();
+                footer.count = storedEntries.size() + entries.size();
+                footer.prevBatchOffset = prevBatchRef.first;
+                footer.prevBatchLength = prevBatchRef.second;
+                footer.reserved = 0;
+                std::copy(Magic, Magic + 4, footer.magic);
+
+                data.append(reinterpret_cast<const char*>(storedEntries.constData()),
+                            storedEntries.size() * sizeof(Entry));
+                for( Entry entry: entries )
+                {
+                    entry.payloadOffset += payloadBase;
+                    data.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+                }
+                data.append(reinterpret_cast<const char*>(&footer), sizeof(footer));
+                return data;
+            }
+
+            string_ref_t intern(const QString& s)
+            {
+                auto it = interned.find(s);
+                if( it == interned.end() )
+                {
+                    const string_ref_t ref(base + strings.size(), s.size());
+                    strings.append(reinterpret_cast<const char*>(s.constData()),
+                                   s.size() * sizeof(QChar));
+                    it = interned.insert(s, ref);
+                }
+                return *it;
+            }
+
+        private:
+            // Strings come first, at an offset aligned for QChar
+            quint64 base;
+            QVector<Entry> entries;
+            QByteArray strings;
+            QHash<QString, string_ref_t> interned;
+            QByteArray payload;
+    };
+
+    QByteArray header()
+    {
+        Header header;
+        std::copy(Magic, Magic + 4, header.magic);
+        header.byteOrder = ByteOrderMark;
+        header.version = FormatVersion;
+        header.reserved = 0;
+        return QByteArray(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    bool saveFile(const QString& path, const QByteArray& data)
+    {
+        QSaveFile file(path);
+        if( !file.open(QFile::WriteOnly) || file.write(data) != data.size() || !file.commit() )
+        {
+            qWarning() << "EventStore: couldn't write" << path << ":" << file.errorString();
+            return false;
+        }
+        return true;
+    }
+}
+
+class EventStore::Private
+{
+    public:
+        Private()
+            : map(nullptr), footer(nullptr), entries(nullptr)
+        { }
+
+        const Entry& entry(int index) const { return entries[index]; }
+        QString string(quint64 offset, quint32 length) const
+        {
+            return QString(reinterpret_cast<const QChar*>(map + offset), int(length));
+        }
+        /** Checks that the index only refers to data within the file */
+        bool validate(quint64 fileSize);
+
+        QFile file;
+        uchar* map;
+        const Footer* footer;
+        const Entry* entries;
+};
+
+/** Checks that a string or a payload lies between the header and the index */
+static bool inData(quint64 offset, quint64 size, quint64 indexOffset)
+{
+    return offset >= sizeof(Header) && offset <= indexOffset &&
+           size <= indexOffset - offset;
+}
+
+bool EventStore::Private::validate(quint64 fileSize)
+{
+    if( fileSize < sizeof(Header) + sizeof(Footer) )
+        return false;
+    const Header* header = reinterpret_cast<const Header*>(map);
+    if( !std::equal(Magic, Magic + 4, header->magic) ||
+        header->byteOrder != ByteOrderMark || header->version != FormatVersion )
+        return false;
+
+    footer = reinterpret_cast<const Footer*>(map + fileSize - sizeof(Footer));
+    const quint64 indexOffset = footer->indexOffset;
+    if( !std::equal(Magic, Magic + 4, footer->magic) ||
+        indexOffset < sizeof(Header) || indexOffset % 8 != 0 ||
+        indexOffset > fileSize - sizeof(Footer) ||
+        (fileSize - sizeof(Footer) - indexOffset) != quint64(footer->count) * sizeof(Entry) ||
+        footer->count > quint32(std::numeric_limits<int>::max()) )
+        return false;
+    entries = reinterpret_cast<const Entry*>(map + indexOffset);
+
+    auto validString = [=] (quint64 offset, quint32 length) {
+        return offset % sizeof(QChar) == 0 && length <= quint32(std::numeric_limits<int>::max()) &&
+               inData(offset, quint64(length) * sizeof(QChar), indexOffset);
+    };
+    if( footer->prevBatchLength > 0 &&
+            !validString(footer->prevBatchOffset, footer->prevBatchLength) )
+        return false;
+    for( quint32 i = 0; i < footer->count; ++i )
+    {
+        const Entry& e = entries[i];
+        if( (e.idLength > 0 && !validString(e.idOffset, e.idLength)) ||
+            (e.senderLength > 0 && !validString(e.senderOffset, e.senderLength)) ||
+            !inData(e.payloadOffset, e.payloadSize, indexOffset) ||
+            e.payloadSize > quint32(std::numeric_limits<int>::max()) )
+            return false;
+        // lowerBound() relies on the order
+        if( i > 0 && e.timestamp < entries[i - 1].timestamp )
+            return false;
+    }
+    return true;
+}
+
+EventStore::EventStore()
+    : d(new Private)
+{
+}
+
+EventStore::~EventStore()
+{
+    close();
+    delete d;
+}
+
+template <typename ContT>
+static bool writeEvents(const QString& path, const ContT& events,
+                        const QString& prevBatch)
+{
+    Builder builder(sizeof(Header));
+    for( const Event* e: events )
+        builder.add(e);
+    const string_ref_t prevBatchRef = builder.intern(prevBatch);
+    return saveFile(path, header() + builder.finish({}, prevBatchRef));
+}
+
+bool EventStore::write(const QString& path, const QList<Event*>& events,
+                       const QString& prevBatch)
+{
+    return writeEvents(path, events, prevBatch);
+}
+
+bool EventStore::write(const QString& path, const Timeline& events,
+                       const QString& prevBatch)
+{
+    return writeEvents(path, events, prevBatch);
+}
+
+bool EventStore::append(const QList<Event*>& events)
+{
+    return append(events.toVector());
+}
+
+bool EventStore::append(const QVector<Event*>& events)
+{
+    if( !isOpen() )
+        return false;
+    if( events.isEmpty() )
+        return true;
+    if( size() > 0 && events.front()->timestampMsecs() < timestamp(size() - 1) )
+    {
+        qWarning() << "EventStore: events to append are older than stored ones";
+        return false;
+    }
+
+    // New data goes in place of the old index; the index of all events and
+    // the footer are written after it. Stored events are not touched.
+    const quint64 base = d->footer->indexOffset;
+    QVector<Entry> storedEntries;
+    storedEntries.reserve(size());
+    for( int i = 0; i < size(); ++i )
+        storedEntries.push_back(d->entries[i]);
+    const string_ref_t prevBatchRef(d->footer->prevBatchOffset,
+                                    d->footer->prevBatchLength);
+    Builder builder(base);
+    for( const Event* e: events )
+        builder.add(e);
+    const QByteArray data = builder.finish(storedEntries, prevBatchRef);
+
+    // The file can't be written to while it's mapped on some platforms
+    const QString path = d->file.fileName();
+    close();
+    QFile file(path);
+    // Cutting the old index and footer off first makes sure that a write
+    // failed midway doesn't leave a footer pointing to overwritten data
+    bool saved = file.open(QFile::ReadWrite) && file.resize(qint64(base)) &&
+                 file.seek(qint64(base)) &&
+                 file.write(data) == data.size() && file.flush();
+    if( !saved )
+        qWarning() << "EventStore: couldn't append to" << path << ":" << file.errorString();
+    file.close();
+    // If writing has failed, the footer is missing and open() fails
+    return open(path) && saved;
+}
+
+bool EventStore::open(const QString& path)
+{
+    close();
+    d->file.setFileName(path);
+    if( !d->file.open(QFile::ReadOnly) )
+        return false;
+
+    const qint64 fileSize = d->file.size();
+    if( fileSize > 0 )
+        d->map = d->file.map(0, fileSize);
+    if( !d->map )
+    {
+        qWarning() << "EventStore: couldn't map" << path;
+        close();
+        return false;
+    }
+    // Everything is checked once here, so that accessors don't have to
+    if( !d->validate(quint64(fileSize)) )
+    {
+        qWarning() << "EventStore: unknown or broken format of" << path;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void EventStore::close()
+{
+    if( d->map )
+        d->file.unmap(d->map);
+    d->file.close();
+    d->map = nullptr;
+    d->footer = nullptr;
+    d->entries = nullptr;
+}
+
+bool EventStore::isOpen() const
+{
+    return d->footer != nullptr;
+}
+
+QString EventStore::path() const
+{
+    return d->file.fileName();
+}
+
+int EventStore::size() const
+{
+    return d->footer ? int(d->footer->count) : 0;
+}
+
+EventType EventStore::type(int index) const
+{
+    return EventType(d->entry(index).type);
+}
+
+qint64 EventStore::timestamp(int index) const
+{
+    return d->entry(index).timestamp;
+}
+
+QString EventStore::id(int index) const
+{
+    const Entry& e = d->entry(index);
+    return d->string(e.idOffset, e.idLength);
+}
+
+QString EventStore::sender(int index) const
+{
+    const Entry& e = d->entry(index);
+    return d->string(e.senderOffset, e.senderLength);
+}
+
+QString EventStore::prevBatch() const
+{
+    if( !d->footer )
+        return QString();
+    return d->string(d->footer->prevBatchOffset, d->footer->prevBatchLength);
+}
+
+int EventStore::lowerBound(qint64 timestamp) const
+{
+    const Entry* end = d->entries + size();
+    return std::lower_bound(d->entries, end, timestamp,
+        [](const Entry& e, qint64 ts) { return e.timestamp < ts; }) - d->entries;
+}
+
+Event* EventStore::load(int index) const
+{
+    const Entry& e = d->entry(index);
+    // The decoded value doesn't refer to the mapping, and there's no text
+    // parsing involved.
+    QCborParserError error;
+    const QCborValue cbor = QCborValue::fromCbor(
+        QByteArray::fromRawData(reinterpret_cast<const char*>(d->map + e.payloadOffset),
+                                int(e.payloadSize)), &error);
+    if( error.error != QCborError::NoError || !cbor.isMap() )
+    {
+        qWarning() << "EventStore: broken event" << id(index) << "in" << path();
+        return nullptr;
+    }
+    return Event::fromJson(cbor.toMap().toJsonObject());
+}
@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef QMATRIXCLIENT_EVENTSTORE_H
+#define QMATRIXCLIENT_EVENTSTORE_H
+
+#include <QtCore/QString>
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+namespace QMatrixClient
+{
+    class Event;
+    class Timeline;
+    enum class EventType;
+
+    /**
+     * @brief A read-only, memory-mapped file of events
+     *
+     * The file consists of a header, one or more blocks of interned UTF-16
+     * strings and event payloads in CBOR, and, at the very end, an index
+     * with a fixed-size entry for each event (type, timestamp, offsets of
+     * the event id, the sender and the payload) followed by a footer that
+     * points to the index. Events are sorted by their timestamps. Index
+     * lookups only touch the mapped pages and don't need any parsing;
+     * load() materializes a single event when it's needed.
+     */
+    class EventStore
+    {
+        public:
+            EventStore();
+            ~EventStore();
+
+            /**
+             * Writes events, which must be sorted by timestamp, to a file.
+             * @param prevBatch the pagination token that leads to events
+             * preceding the earliest of the saved ones
+             */
+            static bool write(const QString& path, const QList<Event*>& events,
+                              const QString& prevBatch);
+            /** Writes the whole timeline without making a list of it */
+            static bool write(const QString& path, const Timeline& events,
+                              const QString& prevBatch);
+
+            /**
+             * Adds events, which must be sorted and not earlier than any
+             * stored event, to the end of the open store. Only the new
+             * strings and payloads, the index and the footer are written;
+             * stored data stays in place. If writing fails, the file is left
+             * without a footer and open() rejects it.
+             */
+            bool append(const QList<Event*>& events);
+            bool append(const QVector<Event*>& events);
+
+            bool open(const QString& path);
+            void close();
+            bool isOpen() const;
+            QString path() const;
+
+            int size() const;
+            EventType type(int index) const;
+            qint64 timestamp(int index) const;
+            QString id(int index) const;
+            QString sender(int index) const;
+            QString prevBatch() const;
+
+            /** Index of the first stored event not earlier than timestamp */
+            int lowerBound(qint64 timestamp) const;
+            /** Creates the event at index; the caller takes the ownership */
+            Event* load(int index) const;
+
+        private:
+            class Private;
+            Private* d;
+    };
+}
+
+#endif // QMATRIXCLIENT_EVENTSTORE_H
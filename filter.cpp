@@ -0,0 +1,107 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "filter.h"
+
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+
+using namespace QMatrixClient;
+
+Filter::Filter()
+    : _timelineLimit(-1), _lazyLoadMembers(false)
+{
+}
+
+void Filter::setTimelineLimit(int limit)
+{
+    _timelineLimit = limit;
+}
+
+int Filter::timelineLimit() const
+{
+    return _timelineLimit;
+}
+
+void Filter::setLazyLoadMembers(bool lazy)
+{
+    _lazyLoadMembers = lazy;
+}
+
+bool Filter::lazyLoadMembers() const
+{
+    return _lazyLoadMembers;
+}
+
+void Filter::setNotTypes(const QStringList& types)
+{
+    _notTypes = types;
+}
+
+QStringList Filter::notTypes() const
+{
+    return _notTypes;
+}
+
+QJsonObject Filter::toJson() const
+{
+    QJsonObject timeline;
+    QJsonObject state;
+    QJsonObject ephemeral;
+    if( _timelineLimit >= 0 )
+        timeline.insert("limit", _timelineLimit);
+    if( _lazyLoadMembers )
+        state.insert("lazy_load_members", true);
+    if( !_notTypes.isEmpty() )
+    {
+        const QJsonArray notTypes = QJsonArray::fromStringList(_notTypes);
+        timeline.insert("not_types", notTypes);
+        state.insert("not_types", notTypes);
+        ephemeral.insert("not_types", notTypes);
+    }
+
+    QJsonObject room;
+    if( !timeline.isEmpty() )
+        room.insert("timeline", timeline);
+    if( !state.isEmpty() )
+        room.insert("state", state);
+    if( !ephemeral.isEmpty() )
+        room.insert("ephemeral", ephemeral);
+    QJsonObject json;
+    if( !room.isEmpty() )
+        json.insert("room", room);
+    return json;
+}
+
+QString Filter::toJsonText() const
+{
+    // QJsonObject keeps keys sorted, so equal filters give equal texts
+    return QString::fromUtf8(QJsonDocument(toJson()).toJson(QJsonDocument::Compact));
+}
+
+bool Filter::operator==(const Filter& other) const
+{
+    return _timelineLimit == other._timelineLimit &&
+           _lazyLoadMembers == other._lazyLoadMembers &&
+           _notTypes == other._notTypes;
+}
+
+bool Filter::operator!=(const Filter& other) const
+{
+    return !operator==(other);
+}
@@ -0,0 +1,75 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef QMATRIXCLIENT_FILTER_H
+#define QMATRIXCLIENT_FILTER_H
+
+#include <QtCore/QStringList>
+#include <QtCore/QJsonObject>
+
+namespace QMatrixClient
+{
+    /**
+     * @brief A sync filter, as in POST /user/{userId}/filter
+     *
+     * Only covers what the library makes use of; everything not set
+     * is left to the server defaults.
+     */
+    class Filter
+    {
+        public:
+            Filter();
+
+            /** Max events per room timeline; negative for the server default */
+            void setTimelineLimit(int limit);
+            int timelineLimit() const;
+            /**
+             * Only send member events for the senders of the events
+             * in the response, instead of the whole member list of each room
+             *
+             * Not supported by Room yet: it doesn't read the room summary
+             * (m.heroes and member counts) that comes instead, so room names
+             * and member lists come out incomplete. Off by default.
+             */
+            void setLazyLoadMembers(bool lazy);
+            bool lazyLoadMembers() const;
+            /**
+             * Event types that are never needed; these are left out of
+             * room timelines, state and ephemeral events
+             */
+            void setNotTypes(const QStringList& types);
+            QStringList notTypes() const;
+
+            QJsonObject toJson() const;
+            /**
+             * Compact JSON text of the filter; can be passed instead of
+             * a filter id, and doesn't change as long as the filter doesn't
+             */
+            QString toJsonText() const;
+
+            bool operator==(const Filter& other) const;
+            bool operator!=(const Filter& other) const;
+
+        private:
+            int _timelineLimit;
+            bool _lazyLoadMembers;
+            QStringList _notTypes;
+    };
+}
+
+#endif // QMATRIXCLIENT_FILTER_H
@@ -23,7 +23,11 @@
 #include <QtNetwork/QNetworkRequest>
 #include <QtCore/QTimer>
 
+#include <algorithm>
+#include <random>
+
 #include "../connectiondata.h"
+#include "jobscheduler.h"
 
 using namespace QMatrixClient;
 
@@ -31,14 +35,96 @@ class BaseJob::Private
 {
     public:
         Private(ConnectionData* c, JobHttpType t, bool nt)
-            : connection(c), reply(nullptr), type(t), needsToken(nt) {}
-        
+            : connection(c), reply(nullptr), type(t), needsToken(nt)
+            , priority(JobPriority::Interactive)
+            , maxRetries(3), retries(0)
+            , firstRetryDelay(1000), maxRetryDelay(30000)
+            , coalescable(false), replayed(false)
+        {
+            timer.setSingleShot(true);
+            retryTimer.setSingleShot(true);
+        }
+
+        /** The delay before the next retry, with exponential backoff */
+        int backoffDelay() const;
+
         ConnectionData* connection;
         QNetworkReply* reply;
         JobHttpType type;
         bool needsToken;
+        JobPriority priority;
+
+        int maxRetries;
+        int retries;
+        int firstRetryDelay;
+        int maxRetryDelay;
+        QTimer timer;
+        QTimer retryTimer;
+        bool coalescable;
+        /** The reply is a copy of another job's one */
+        bool replayed;
 };
 
+namespace
+{
+    /**
+     * A finished reply that gives out a copy of another reply's body,
+     * with the same status and headers.
+     */
+    class SharedReply: public QNetworkReply
+    {
+        public:
+            SharedReply(QNetworkReply* source, const QByteArray& body,
+                        QObject* parent)
+                : QNetworkReply(parent), body(body), pos(0)
+            {
+                setOperation(source->operation());
+                setRequest(source->request());
+                setUrl(source->url());
+                setError(source->error(), source->errorString());
+                for (const RawHeaderPair& header: source->rawHeaderPairs())
+                    setRawHeader(header.first, header.second);
+                for (auto attr: { QNetworkRequest::HttpStatusCodeAttribute,
+                                  QNetworkRequest::HttpReasonPhraseAttribute })
+                    setAttribute(attr, source->attribute(attr));
+                open(ReadOnly | Unbuffered);
+                setFinished(true);
+            }
+
+            void abort() override { }
+            bool isSequential() const override { return true; }
+            qint64 bytesAvailable() const override
+            {
+                return body.size() - pos + QIODevice::bytesAvailable();
+            }
+
+        protected:
+            qint64 readData(char* data, qint64 maxSize) override
+            {
+                const qint64 n = std::min(maxSize, qint64(body.size()) - pos);
+                std::copy(body.constData() + pos, body.constData() + pos + n, data);
+                pos += n;
+                return n;
+            }
+
+        private:
+            QByteArray body;
+            qint64 pos;
+    };
+}
+
+int BaseJob::Private::backoffDelay() const
+{
+    // Each client picks a random point in the upper half of the interval,
+    // so that the ones that failed together don't come back together.
+    static std::mt19937 generator { std::random_device()() };
+    const qint64 delay =
+        std::min(qint64(firstRetryDelay) << std::min(retries, 20),
+                 qint64(maxRetryDelay));
+    std::uniform_int_distribution<qint64> spread(delay / 2, delay);
+    return int(spread(generator));
+}
+
 BaseJob::BaseJob(ConnectionData* connection, JobHttpType type, QString name, bool needsToken)
     : d(new Private(connection, type, needsToken))
 {
@@ -49,6 +135,8 @@ BaseJob::BaseJob(ConnectionData* connection, JobHttpType type, QString name, boo
         else
             emit failure(this);
     });
+    connect(&d->timer, &QTimer::timeout, this, &BaseJob::timeout);
+    connect(&d->retryTimer, &QTimer::timeout, this, &BaseJob::sendRequest);
     setObjectName(name);
     qDebug() << "Job" << objectName() << " created";
 }
@@ -85,7 +173,92 @@ void BaseJob::parseJson(const QJsonDocument& data)
     emitResult();
 }
 
+JobPriority BaseJob::priority() const
+{
+    return d->priority;
+}
+
+void BaseJob::setPriority(JobPriority priority)
+{
+    d->priority = priority;
+}
+
+void BaseJob::setRetryPolicy(int maxRetries, int firstDelayMsecs,
+                             int maxDelayMsecs)
+{
+    d->maxRetries = maxRetries;
+    d->firstRetryDelay = firstDelayMsecs;
+    d->maxRetryDelay = maxDelayMsecs;
+}
+
+int BaseJob::maxRetries() const
+{
+    return d->maxRetries;
+}
+
+int BaseJob::retries() const
+{
+    return d->retries;
+}
+
+void BaseJob::setCoalescable(bool coalescable)
+{
+    d->coalescable = coalescable;
+}
+
+bool BaseJob::isCoalescable() const
+{
+    return d->coalescable;
+}
+
 void BaseJob::start()
+{
+    JobScheduler* scheduler = d->connection->scheduler();
+    if( d->coalescable && d->type == JobHttpType::GetJob &&
+            scheduler->follow(this) )
+        return;
+    scheduler->enqueue(this);
+}
+
+QString BaseJob::requestKey() const
+{
+    // The access token is the same for all jobs of the connection
+    return "GET " + apiPath() + '?' + query().toString(QUrl::FullyEncoded);
+}
+
+void BaseJob::finishRequest()
+{
+    JobScheduler* scheduler = d->connection->scheduler();
+    scheduler->shareReply(this, d->reply);
+    scheduler->requestFinished(this);
+}
+
+void BaseJob::replay(QNetworkReply* reply)
+{
+    qDebug() << "Job" << objectName() << "got a shared reply";
+    d->reply = new SharedReply(reply, reply->peek(reply->bytesAvailable()), this);
+    d->replayed = true;
+    // Not from inside the job that received the original
+    QMetaObject::invokeMethod(this, "gotReply", Qt::QueuedConnection);
+}
+
+bool BaseJob::doKill()
+{
+    d->timer.stop();
+    d->retryTimer.stop();
+    if( d->connection->scheduler()->dequeue(this) )
+        return true;
+    if( d->reply )
+    {
+        // Don't let the aborted reply finish the job once more
+        d->reply->disconnect(this);
+        if( d->reply->isRunning() )
+            d->reply->abort();
+    }
+    return true;
+}
+
+void BaseJob::sendRequest()
 {
     QUrl url = d->connection->baseUrl();
     url.setPath( url.path() + "/" + apiPath() );
@@ -113,14 +286,53 @@ void BaseJob::start()
             break;
     }
     connect( d->reply, &QNetworkReply::sslErrors, this, &BaseJob::sslErrors );
+    connect( d->reply, &QNetworkReply::readyRead, this, &BaseJob::gotPartialReply );
+    connect( d->reply, &QNetworkReply::finished, &d->timer, &QTimer::stop );
     connect( d->reply, &QNetworkReply::finished, this, &BaseJob::gotReply );
-    QTimer::singleShot( 120*1000, this, SLOT(timeout()) );
+    d->timer.start( 120*1000 );
 //     connect( d->reply, static_cast<void(QNetworkReply::*)(QNetworkReply::NetworkError)>(&QNetworkReply::error),
 //              this, &BaseJob::networkError ); // http://doc.qt.io/qt-5/qnetworkreply.html#error-1
 }
 
+bool BaseJob::retry(int delayMsecs)
+{
+    // A shared reply is final; the job that made the request has already
+    // done all the retries
+    if( d->replayed )
+        return false;
+    if( d->maxRetries >= 0 && d->retries >= d->maxRetries )
+        return false;
+
+    if( delayMsecs < 0 )
+        delayMsecs = d->backoffDelay();
+    ++d->retries;
+    d->timer.stop();
+    if( d->reply )
+    {
+        d->reply->disconnect(this);
+        if( d->reply->isRunning() )
+            d->reply->abort();
+        d->reply->deleteLater();
+        d->reply = nullptr;
+    }
+    qDebug() << "Job" << objectName() << "will retry in" << delayMsecs << "ms,"
+             << "attempt" << d->retries + 1;
+    beforeRetry();
+    // The job keeps its place in the scheduler while waiting, so that other
+    // jobs of the same class don't rush at a server that's in trouble.
+    d->retryTimer.start(delayMsecs);
+    emit retryScheduled(this, delayMsecs);
+    return true;
+}
+
+void BaseJob::beforeRetry()
+{
+}
+
 void BaseJob::fail(int errorCode, QString errorString)
 {
+    d->timer.stop();
+    d->retryTimer.stop();
     setError( errorCode );
     setErrorText( errorString );
     if( d->reply && d->reply->isRunning() )
@@ -139,25 +351,79 @@ QNetworkReply* BaseJob::networkReply() const
 //     fail( KJob::UserDefinedError+1, d->reply->errorString() );
 // }
 
-void BaseJob::gotReply()
+bool BaseJob::checkReply()
 {
+    const int httpStatus =
+        d->reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if( httpStatus == 429 )
+    {
+        // The server hasn't done anything with the request, so it's safe
+        // to repeat it whatever the method
+        const QJsonObject json = QJsonDocument::fromJson(
+                d->reply->peek(d->reply->bytesAvailable())).object();
+        int delay = json.value("retry_after_ms").toInt(-1);
+        if( delay < 0 && d->reply->hasRawHeader("Retry-After") )
+        {
+            bool ok = false;
+            const int secs = d->reply->rawHeader("Retry-After").toInt(&ok);
+            if( ok )
+                delay = secs * 1000;
+        }
+        qDebug() << "Job" << objectName() << "is rate-limited:"
+                 << json.value("error").toString();
+        if( !retry(delay) )
+        {
+            finishRequest();
+            fail( TooManyRequestsError, "Too many requests to the server" );
+        }
+        return false;
+    }
+
     switch( d->reply->error() )
     {
     case QNetworkReply::NoError:
-        break; // All good, go to the normal flow after the switch()
+        finishRequest();
+        return true;
 
     case QNetworkReply::AuthenticationRequiredError:
     case QNetworkReply::ContentAccessDenied:
     case QNetworkReply::ContentOperationNotPermittedError:
         qDebug() << "Content access error, Qt error code:" << d->reply->error();
+        finishRequest();
         fail( ContentAccessError, d->reply->errorString() );
-        return;
+        return false;
+
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::HostNotFoundError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyConnectionClosedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownNetworkError:
+        qDebug() << "Transient NetworkError, Qt error code:" << d->reply->error();
+        if( d->type == JobHttpType::PostJob || !retry() )
+        {
+            finishRequest();
+            fail( NetworkError, d->reply->errorString() );
+        }
+        return false;
 
     default:
         qDebug() << "NetworkError, Qt error code:" << d->reply->error();
+        if( httpStatus >= 500 && d->type != JobHttpType::PostJob && retry() )
+            return false;
+        finishRequest();
         fail( NetworkError, d->reply->errorString() );
-        return;
+        return false;
     }
+}
+
+void BaseJob::gotReply()
+{
+    if( !checkReply() )
+        return;
 
     QJsonParseError error;
     QJsonDocument data = QJsonDocument::fromJson(d->reply->readAll(), &error);
@@ -169,8 +435,15 @@ void BaseJob::gotReply()
     parseJson(data);
 }
 
+void BaseJob::gotPartialReply()
+{
+}
+
 void BaseJob::timeout()
 {
+    qDebug() << "Job" << objectName() << "has timed out";
+    if( d->type != JobHttpType::PostJob && retry() )
+        return;
     fail( TimeoutError, "The job has timed out" );
 }
 
@@ -35,6 +35,10 @@ namespace QMatrixClient
     class ConnectionData;
 
     enum class JobHttpType { GetJob, PutJob, PostJob };
+    /**
+     * Classes of jobs for JobScheduler, from the most to the least urgent
+     */
+    enum class JobPriority { Interactive, Sync, Backfill, Prefetch };
     
     class BaseJob: public KJob
     {
@@ -44,10 +48,55 @@ namespace QMatrixClient
                     QString name, bool needsToken=true);
             virtual ~BaseJob();
 
+            /**
+             * Hands the job over to the connection's JobScheduler, which
+             * sends the request when the limits for the job's priority allow.
+             */
             void start() override;
 
+            JobPriority priority() const;
+            /** Should be called before start(); Interactive by default */
+            void setPriority(JobPriority priority);
+
+            /**
+             * @brief Sets how many times the request is repeated on errors
+             * that may go away on their own
+             *
+             * These are timeouts, network failures and 5xx responses, as
+             * well as 429 (M_LIMIT_EXCEEDED). The request is sent again
+             * after a delay that doubles with each attempt, from firstDelay
+             * up to maxDelay, with a random spread so that clients failed
+             * at the same moment don't come back at the same moment;
+             * if the server says when to come back (retry_after_ms),
+             * that delay is used instead. POST requests are only repeated
+             * after 429, as the server might have processed them otherwise.
+             *
+             * A negative maxRetries means retrying forever; 0 disables
+             * retries. The default is 3 retries, 1 to 30 seconds apart;
+             * job classes may change it in their constructors.
+             */
+            void setRetryPolicy(int maxRetries, int firstDelayMsecs = 1000,
+                                int maxDelayMsecs = 30000);
+            int maxRetries() const;
+            /** The number of retries made so far */
+            int retries() const;
+
+            /**
+             * @brief Lets the job share the reply with identical requests
+             *
+             * If a GET job is started while a job with the same API path and
+             * query is queued or running, no new request is made; the job
+             * gets a copy of the other job's reply, with the same status,
+             * headers and body, once that one is final. Only suitable for
+             * jobs that read the reply in gotReply(), not in
+             * gotPartialReply(). Off by default.
+             */
+            void setCoalescable(bool coalescable);
+            bool isCoalescable() const;
+
             enum ErrorCode { NetworkError = KJob::UserDefinedError,
                              JsonParseError, TimeoutError, ContentAccessError,
+                             TooManyRequestsError,
                              UserDefinedError = 512 };
 
         signals:
@@ -60,6 +109,11 @@ namespace QMatrixClient
              * Same as result(), this won't be emitted in case of kill(Quietly).
              */
             void failure(BaseJob*);
+            /**
+             * Emitted when the request failed and will be sent again after
+             * delayMsecs; KJob::result() is not emitted in this case.
+             */
+            void retryScheduled(BaseJob*, int delayMsecs);
 
         protected:
             ConnectionData* connection() const;
@@ -72,10 +126,28 @@ namespace QMatrixClient
             
             void fail( int errorCode, QString errorString );
             QNetworkReply* networkReply() const;
+            /**
+             * Checks the network reply for errors and fails the job if there
+             * are any. Returns true if the reply can be processed further.
+             */
+            bool checkReply();
+            /**
+             * Called before sending the request once more after an error;
+             * reimplement to drop whatever has been collected from
+             * the failed reply. Does nothing by default.
+             */
+            virtual void beforeRetry();
+            /** Takes the job out of the queue or aborts the request */
+            bool doKill() override;
 
             
         protected slots:
             virtual void gotReply();
+            /**
+             * Called every time a new portion of the reply body arrives.
+             * Does nothing by default, leaving the whole body for gotReply().
+             */
+            virtual void gotPartialReply();
             void timeout();
             void sslErrors(const QList<QSslError>& errors);
 
@@ -83,6 +155,27 @@ namespace QMatrixClient
 
 
         private:
+            friend class JobScheduler;
+            /** Actually sends the request; called by JobScheduler */
+            void sendRequest();
+            /**
+             * Drops the current reply and schedules sending the request
+             * again; returns false if no retries are left.
+             * @param delayMsecs the delay requested by the server,
+             * or -1 to use the backoff delay
+             */
+            bool retry(int delayMsecs = -1);
+            /** Identifies requests that can share a reply */
+            QString requestKey() const;
+            /**
+             * Called once the reply is final: passes it to jobs waiting for
+             * the same request and lets the scheduler send the next request
+             * while the job is still processing this one.
+             */
+            void finishRequest();
+            /** Processes a copy of the reply of an identical request */
+            void replay(QNetworkReply* reply);
+
             class Private;
             Private* d;
     };
@@ -0,0 +1,209 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jobscheduler.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QDebug>
+
+using namespace QMatrixClient;
+
+static const int PriorityCount = int(JobPriority::Prefetch) + 1;
+
+class JobScheduler::Private
+{
+    public:
+        // Two syncs let the pipelined one go out while the reply to the
+        // previous one is still coming; prefetching gives way to keep the
+        // lower classes within 5 connections
+        Private()
+            : limits { -1, 2, 2, 1 }, running { 0, 0, 0, 0 }
+        { }
+
+        int limits[PriorityCount];
+        int running[PriorityCount];
+        QList<BaseJob*> queues[PriorityCount];
+        /** Jobs that have been sent, with their priorities */
+        QHash<KJob*, int> runningJobs;
+        /** Jobs making coalescable requests, by the request key */
+        QHash<QString, BaseJob*> leaders;
+        QHash<BaseJob*, QString> leaderKeys;
+        /** Jobs waiting for the replies of the leaders */
+        QHash<BaseJob*, QList<BaseJob*>> followers;
+};
+
+JobScheduler::JobScheduler()
+    : d(new Private)
+{
+}
+
+JobScheduler::~JobScheduler()
+{
+    delete d;
+}
+
+void JobScheduler::setLimit(JobPriority priority, int maxRunning)
+{
+    d->limits[int(priority)] = maxRunning;
+    dispatch();
+}
+
+int JobScheduler::limit(JobPriority priority) const
+{
+    return d->limits[int(priority)];
+}
+
+int JobScheduler::runningCount(JobPriority priority) const
+{
+    return d->running[int(priority)];
+}
+
+int JobScheduler::queuedCount(JobPriority priority) const
+{
+    return d->queues[int(priority)].size();
+}
+
+void JobScheduler::enqueue(BaseJob* job)
+{
+    d->queues[int(job->priority())].push_back(job);
+    connect(job, &QObject::destroyed, this, &JobScheduler::jobDestroyed,
+            Qt::UniqueConnection);
+    dispatch();
+}
+
+bool JobScheduler::dequeue(BaseJob* job)
+{
+    for( QList<BaseJob*>& queue: d->queues )
+        if( queue.removeOne(job) )
+            return true;
+    for( QList<BaseJob*>& waiting: d->followers )
+        if( waiting.removeOne(job) )
+            return true;
+    return false;
+}
+
+bool JobScheduler::follow(BaseJob* job)
+{
+    connect(job, &QObject::destroyed, this, &JobScheduler::jobDestroyed,
+            Qt::UniqueConnection);
+    connect(job, &KJob::finished, this, &JobScheduler::jobFinished,
+            Qt::UniqueConnection);
+    const QString key = job->requestKey();
+    if( BaseJob* leader = d->leaders.value(key) )
+    {
+        qDebug() << "JobScheduler:" << job->objectName()
+                 << "will share the reply of" << leader->objectName();
+        d->followers[leader].push_back(job);
+        return true;
+    }
+    d->leaders.insert(key, job);
+    d->leaderKeys.insert(job, key);
+    return false;
+}
+
+void JobScheduler::shareReply(BaseJob* job, QNetworkReply* reply)
+{
+    auto it = d->leaderKeys.find(job);
+    if( it == d->leaderKeys.end() )
+        return;
+    // Jobs started from now on make a new request
+    d->leaders.remove(*it);
+    d->leaderKeys.erase(it);
+    for( BaseJob* follower: d->followers.take(job) )
+        follower->replay(reply);
+}
+
+void JobScheduler::release(BaseJob* job)
+{
+    auto it = d->leaderKeys.find(job);
+    if( it == d->leaderKeys.end() )
+        return;
+    const QString key = *it;
+    d->leaderKeys.erase(it);
+    QList<BaseJob*> waiting = d->followers.take(job);
+    if( waiting.isEmpty() )
+    {
+        d->leaders.remove(key);
+        return;
+    }
+    // The job ended without a reply to share (e.g., it was killed or
+    // has timed out), so the next one in line makes the request
+    BaseJob* next = waiting.takeFirst();
+    d->leaders.insert(key, next);
+    d->leaderKeys.insert(next, key);
+    if( !waiting.isEmpty() )
+        d->followers.insert(next, waiting);
+    enqueue(next);
+}
+
+void JobScheduler::cancelQueued(JobPriority priority)
+{
+    QList<BaseJob*> cancelled;
+    cancelled.swap(d->queues[int(priority)]);
+    // Jobs waiting for the replies of the cancelled ones go as well
+    for( int i = 0, n = cancelled.size(); i < n; ++i )
+        cancelled += d->followers.take(cancelled[i]);
+    qDebug() << "JobScheduler: cancelling" << cancelled.size() << "queued job(s)";
+    for( BaseJob* job: cancelled )
+        job->kill(KJob::EmitResult);
+}
+
+void JobScheduler::dispatch()
+{
+    for( int p = 0; p < PriorityCount; ++p )
+    {
+        QList<BaseJob*>& queue = d->queues[p];
+        while( !queue.isEmpty() &&
+               (d->limits[p] < 0 || d->running[p] < d->limits[p]) )
+        {
+            BaseJob* job = queue.takeFirst();
+            ++d->running[p];
+            d->runningJobs.insert(job, p);
+            connect(job, &KJob::finished, this, &JobScheduler::jobFinished,
+                    Qt::UniqueConnection);
+            job->sendRequest();
+        }
+    }
+}
+
+void JobScheduler::requestFinished(BaseJob* job)
+{
+    auto it = d->runningJobs.find(job);
+    if( it == d->runningJobs.end() )
+        return;
+    --d->running[*it];
+    d->runningJobs.erase(it);
+    dispatch();
+}
+
+void JobScheduler::jobFinished(KJob* job)
+{
+    release(static_cast<BaseJob*>(job));
+    requestFinished(static_cast<BaseJob*>(job));
+}
+
+void JobScheduler::jobDestroyed(QObject* job)
+{
+    // Only the pointer is valid at this point
+    for( QList<BaseJob*>& queue: d->queues )
+        queue.removeAll(static_cast<BaseJob*>(job));
+    for( QList<BaseJob*>& waiting: d->followers )
+        waiting.removeAll(static_cast<BaseJob*>(job));
+    jobFinished(static_cast<KJob*>(job));
+}
@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef QMATRIXCLIENT_JOBSCHEDULER_H
+#define QMATRIXCLIENT_JOBSCHEDULER_H
+
+#include <QtCore/QObject>
+
+#include "basejob.h"
+
+class KJob;
+
+namespace QMatrixClient
+{
+    /**
+     * @brief Decides when started jobs actually send their requests
+     *
+     * Each priority class has a limit of requests in flight; jobs above
+     * the limit wait in a queue until a job of the same class finishes.
+     * Queues of higher classes are always served first. By default,
+     * the lower classes together take at most 5 connections, which is less
+     * than the 6 that QNetworkAccessManager opens per host, so interactive
+     * requests never wait behind a pile of downloads.
+     *
+     * The scheduler also keeps track of coalescable jobs (see
+     * BaseJob::setCoalescable()): only the first of identical requests
+     * goes to the queue, the others wait for its reply.
+     */
+    class JobScheduler: public QObject
+    {
+            Q_OBJECT
+        public:
+            JobScheduler();
+            virtual ~JobScheduler();
+
+            /** A negative limit means no limit */
+            void setLimit(JobPriority priority, int maxRunning);
+            int limit(JobPriority priority) const;
+            int runningCount(JobPriority priority) const;
+            int queuedCount(JobPriority priority) const;
+
+            /** Sends the job's request now or as soon as the limits allow */
+            void enqueue(BaseJob* job);
+            /**
+             * Takes the job out of the queue without starting it.
+             * @return false if the job is not queued (e.g., already running)
+             */
+            bool dequeue(BaseJob* job);
+            /**
+             * If an identical request is already queued or running, makes
+             * the job wait for its reply and returns true; otherwise
+             * remembers the job as the one making this request and
+             * returns false, and the job should be enqueued as usual.
+             */
+            bool follow(BaseJob* job);
+            /**
+             * Gives a copy of the final reply to all jobs waiting
+             * for the job's request
+             */
+            void shareReply(BaseJob* job, QNetworkReply* reply);
+            /**
+             * Frees the job's place among the running ones, even though
+             * the job itself has not finished processing the reply yet
+             */
+            void requestFinished(BaseJob* job);
+            /**
+             * Kills all queued jobs of the given class, and the jobs waiting
+             * for their replies, with KJob::result() emitted; running jobs
+             * are not affected.
+             */
+            void cancelQueued(JobPriority priority);
+
+        private slots:
+            void jobFinished(KJob* job);
+            void jobDestroyed(QObject* job);
+
+        private:
+            void dispatch();
+            /** Forgets the job's request; passes it on to the next waiting job */
+            void release(BaseJob* job);
+
+            class Private;
+            Private* d;
+    };
+}
+
+#endif // QMATRIXCLIENT_JOBSCHEDULER_H
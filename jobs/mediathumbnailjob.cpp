@@ -41,6 +41,11 @@ MediaThumbnailJob::MediaThumbnailJob(ConnectionData* data, QUrl url, int request
     d->requestedHeight = requestedHeight;
     d->requestedWidth = requestedWidth;
     d->thumbnailType = thumbnailType;
+    setPriority(JobPriority::Prefetch);
+    // A missing thumbnail is not a big deal; don't hold up other downloads
+    setRetryPolicy(1);
+    // The same userpic is often requested for many users and views at once
+    setCoalescable(true);
 }
 
 MediaThumbnailJob::~MediaThumbnailJob()
@@ -72,13 +77,8 @@ QUrlQuery MediaThumbnailJob::query() const
 
 void MediaThumbnailJob::gotReply()
 {
-    if( networkReply()->error() != QNetworkReply::NoError )
-    {
-        qDebug() << "NetworkError!!!";
-        qDebug() << networkReply()->errorString();
-        fail( NetworkError, networkReply()->errorString() );
+    if( !checkReply() )
         return;
-    }
 
     if( !d->thumbnail.loadFromData( networkReply()->readAll() ) )
     {
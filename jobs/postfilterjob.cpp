@@ -0,0 +1,76 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "postfilterjob.h"
+
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+
+#include "../filter.h"
+
+using namespace QMatrixClient;
+
+class PostFilterJob::Private
+{
+    public:
+        Private() {}
+
+        QString userId;
+        QJsonObject filter;
+        QString filterId;
+};
+
+PostFilterJob::PostFilterJob(ConnectionData* connection, QString userId,
+                             const Filter& filter)
+    : BaseJob(connection, JobHttpType::PostJob, "PostFilterJob")
+    , d(new Private)
+{
+    d->userId = userId;
+    d->filter = filter.toJson();
+}
+
+PostFilterJob::~PostFilterJob()
+{
+    delete d;
+}
+
+QString PostFilterJob::filterId() const
+{
+    return d->filterId;
+}
+
+QString PostFilterJob::apiPath() const
+{
+    return QString("_matrix/client/r0/user/%1/filter").arg(d->userId);
+}
+
+QJsonObject PostFilterJob::data() const
+{
+    return d->filter;
+}
+
+void PostFilterJob::parseJson(const QJsonDocument& data)
+{
+    d->filterId = data.object().value("filter_id").toString();
+    if( d->filterId.isEmpty() )
+    {
+        fail( BaseJob::UserDefinedError, "No filter id in the response" );
+        return;
+    }
+    emitResult();
+}
@@ -39,6 +39,7 @@ RoomMembersJob::RoomMembersJob(ConnectionData* data, Room* room)
     , d(new Private)
 {
     d->room = room;
+    setPriority(JobPriority::Backfill);
 }
 
 RoomMembersJob::~RoomMembersJob()
@@ -46,6 +47,11 @@ RoomMembersJob::~RoomMembersJob()
     delete d;
 }
 
+Room* RoomMembersJob::room() const
+{
+    return d->room;
+}
+
 QList< State* > RoomMembersJob::states()
 {
     return d->states;
@@ -32,6 +32,7 @@ namespace QMatrixClient
             RoomMembersJob(ConnectionData* data, Room* room);
             virtual ~RoomMembersJob();
 
+            Room* room() const;
             QList<State*> states();
 
         protected:
@@ -47,10 +47,12 @@ RoomMessagesJob::RoomMessagesJob(ConnectionData* data, Room* room, QString from,
     d->from = from;
     d->dir = dir;
     d->limit = limit;
+    setPriority(JobPriority::Backfill);
 }
 
 RoomMessagesJob::~RoomMessagesJob()
 {
+    qDeleteAll(d->events);
     delete d;
 }
 
@@ -59,6 +61,13 @@ QList<Event*> RoomMessagesJob::events()
     return d->events;
 }
 
+QList<Event*> RoomMessagesJob::releaseEvents()
+{
+    QList<Event*> events;
+    events.swap(d->events);
+    return events;
+}
+
 QString RoomMessagesJob::end()
 {
     return d->end;
@@ -84,7 +93,13 @@ QUrlQuery RoomMessagesJob::query() const
 void RoomMessagesJob::parseJson(const QJsonDocument& data)
 {
     QJsonObject obj = data.object();
-    d->events = eventListFromJson(obj.value("chunk").toArray());
+    // See SyncJob on the ownership of the arena
+    EventArena* arena = new EventArena;
+    {
+        EventArena::Scope scope(arena);
+        d->events = eventListFromJson(obj.value("chunk").toArray());
+    }
+    arena->release();
     d->end = obj.value("end").toString();
     emitResult();
 }
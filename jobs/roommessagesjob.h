@@ -34,7 +34,13 @@ namespace QMatrixClient
             RoomMessagesJob(ConnectionData* data, Room* room, QString from, FetchDirectory dir = FetchDirectory::Backwards, int limit=10);
             virtual ~RoomMessagesJob();
 
+            /** The events still belong to the job; see releaseEvents() */
             QList<Event*> events();
+            /**
+             * Hands the events over to the caller; the job deletes
+             * the ones that haven't been taken when it's deleted
+             */
+            QList<Event*> releaseEvents();
             QString end();
 
         protected:
@@ -22,27 +22,163 @@
 #include <QtCore/QJsonObject>
 #include <QtCore/QJsonValue>
 #include <QtCore/QJsonArray>
+#include <QtCore/QFutureWatcher>
 #include <QtCore/QDebug>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtConcurrent/QtConcurrentMap>
 
 #include "../room.h"
 #include "../connectiondata.h"
 #include "../events/event.h"
+#include "syncstreamparser.h"
 
 using namespace QMatrixClient;
 
+/** A portion of the response decoded in the thread pool */
+struct SyncBatch
+{
+    QList<SyncRoomData> rooms;
+    QString nextBatch;
+    QString errorString;
+};
+
 class SyncJob::Private
 {
     public:
+        Private()
+            : streamParser(nullptr), replyFinished(false), filterRejected(false)
+        { }
+        ~Private() { delete streamParser; }
+
+        void enqueue(SyncJob* q, const QFuture<SyncBatch>& future);
+        /**
+         * Deletes the events of batches that haven't been delivered; those
+         * still being decoded are deleted when decoding is over
+         */
+        void dropPendingBatches();
+
         QString since;
         QString filter;
         bool fullState;
         QString presence;
         int timeout;
         QString nextBatch;
+        SyncStreamParser* streamParser;
+        QList<QFutureWatcher<SyncBatch>*> pendingBatches;
+        bool replyFinished;
+        bool filterRejected;
 
         QList<SyncRoomData> roomData;
 };
 
+static SyncBatch decodeRoom(const SyncStreamParser::RoomJson& room)
+{
+    QJsonParseError error;
+    QJsonDocument json = QJsonDocument::fromJson(room.json, &error);
+    if( error.error != QJsonParseError::NoError )
+        return { {}, {}, error.errorString() };
+
+    // Events of the room go to their own arena; the Room that takes them
+    // becomes the owner of the arena as well.
+    EventArena* arena = new EventArena;
+    SyncBatch batch;
+    {
+        EventArena::Scope scope(arena);
+        batch.rooms.push_back({room.roomId, json.object(), room.joinState});
+    }
+    arena->release();
+    return batch;
+}
+
+static void appendRoom(SyncBatch& batch, const SyncBatch& room)
+{
+    if( batch.errorString.isEmpty() )
+        batch.errorString = room.errorString;
+    batch.rooms += room.rooms;
+}
+
+/**
+ * Rooms don't depend on each other, so each one is decoded as a separate
+ * task; QtConcurrent hands out items to idle threads as they come.
+ * OrderedReduce puts the results back in the order of the response.
+ */
+static QFuture<SyncBatch> decodeRooms(const QList<SyncStreamParser::RoomJson>& rooms)
+{
+    return QtConcurrent::mappedReduced<SyncBatch>(rooms, decodeRoom, appendRoom,
+                                                  QtConcurrent::OrderedReduce);
+}
+
+static SyncBatch decodeResponse(const QByteArray& body)
+{
+    SyncStreamParser parser;
+    if( !parser.feed(body) )
+        return { {}, {}, parser.errorString() };
+    if( !parser.atEnd() )
+        return { {}, {}, "The sync response ended prematurely" };
+
+    // This already runs in the pool; the calling thread takes part in
+    // decoding instead of just waiting for other threads.
+    SyncBatch batch = QtConcurrent::blockingMappedReduced<SyncBatch>(
+            parser.takeRooms(), decodeRoom, appendRoom, QtConcurrent::OrderedReduce);
+    batch.nextBatch = parser.nextBatch();
+    return batch;
+}
+
+void SyncJob::Private::enqueue(SyncJob* q, const QFuture<SyncBatch>& future)
+{
+    auto watcher = new QFutureWatcher<SyncBatch>(q);
+    QObject::connect( watcher, &QFutureWatcherBase::finished,
+                      q, &SyncJob::deliverDecoded );
+    pendingBatches.push_back(watcher);
+    watcher->setFuture(future);
+}
+
+static void deleteEvents(SyncBatch& batch)
+{
+    for( SyncRoomData& roomData: batch.rooms )
+        roomData.deleteEvents();
+}
+
+bool SyncJob::decodeBody(const QByteArray& body, QList<SyncRoomData>& rooms,
+                         QString* nextBatch)
+{
+    SyncBatch batch = decodeResponse(body);
+    if( !batch.errorString.isEmpty() )
+    {
+        qWarning() << "SyncJob: couldn't decode the response:" << batch.errorString;
+        deleteEvents(batch);
+        return false;
+    }
+    rooms += batch.rooms;
+    if( nextBatch )
+        *nextBatch = batch.nextBatch;
+    return true;
+}
+
+void SyncJob::Private::dropPendingBatches()
+{
+    for( auto watcher: pendingBatches )
+    {
+        // The job is going away, and the decoding task can't be stopped
+        // midway; the watcher stays around to clean up after it.
+        watcher->disconnect();
+        watcher->setParent(nullptr);
+        if( watcher->isFinished() )
+        {
+            SyncBatch batch = watcher->result();
+            deleteEvents(batch);
+            delete watcher;
+            continue;
+        }
+        QObject::connect( watcher, &QFutureWatcherBase::finished, [watcher] {
+            SyncBatch batch = watcher->result();
+            deleteEvents(batch);
+            watcher->deleteLater();
+        });
+    }
+    pendingBatches.clear();
+}
+
 static size_t jobId = 0;
 
 SyncJob::SyncJob(ConnectionData* connection, QString since)
@@ -52,10 +188,16 @@ SyncJob::SyncJob(ConnectionData* connection, QString since)
     d->since = since;
     d->fullState = false;
     d->timeout = -1;
+    setPriority(JobPriority::Sync);
+    // Rooms can't be updated until sync succeeds, so try harder than others
+    setRetryPolicy(6, 1000, 60000);
 }
 
 SyncJob::~SyncJob()
 {
+    d->dropPendingBatches();
+    for( SyncRoomData& roomData: d->roomData )
+        roomData.deleteEvents();
     delete d;
 }
 
@@ -79,12 +221,25 @@ void SyncJob::setTimeout(int timeout)
     d->timeout = timeout;
 }
 
+void SyncJob::setStreaming(bool streaming)
+{
+    if( streaming == (d->streamParser != nullptr) )
+        return;
+    delete d->streamParser;
+    d->streamParser = streaming ? new SyncStreamParser : nullptr;
+}
+
 QString SyncJob::nextBatch() const
 {
     return d->nextBatch;
 }
 
-QList<SyncRoomData> SyncJob::roomData() const
+bool SyncJob::filterRejected() const
+{
+    return d->filterRejected;
+}
+
+QList<SyncRoomData>& SyncJob::roomData()
 {
     return d->roomData;
 }
@@ -110,32 +265,130 @@ QUrlQuery SyncJob::query() const
     return query;
 }
 
-void SyncJob::parseJson(const QJsonDocument& data)
+void SyncJob::gotPartialReply()
 {
-    QJsonObject json = data.object();
-    d->nextBatch = json.value("next_batch").toString();
-    // TODO: presence
-    // TODO: account_data
-    QJsonObject rooms = json.value("rooms").toObject();
+    if( !d->streamParser || error() != NoError )
+        return;
+    // An error body is not a sync response; checkReply() will deal with it
+    if( networkReply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() >= 300 )
+        return;
 
-    const struct { QString jsonKey; JoinState enumVal; } roomStates[]
+    if( !d->streamParser->feed(networkReply()->readAll()) )
     {
-        { "join", JoinState::Join },
-        { "invite", JoinState::Invite },
-        { "leave", JoinState::Leave }
-    };
-    for (auto roomState: roomStates)
+        fail( JsonParseError, d->streamParser->errorString() );
+        return;
+    }
+    // The token usually comes before the rooms; the next sync can start
+    // while they are still being received
+    const QString nextBatch = d->streamParser->nextBatch();
+    if( !nextBatch.isEmpty() && nextBatch != d->nextBatch )
+    {
+        d->nextBatch = nextBatch;
+        emit nextBatchReady(d->nextBatch);
+    }
+    const auto rooms = d->streamParser->takeRooms();
+    if( !rooms.isEmpty() )
+        d->enqueue(this, decodeRooms(rooms));
+}
+
+void SyncJob::gotReply()
+{
+    if( error() != NoError )
+        return;
+    // Servers forget filters, e.g. after their database is reset; they
+    // don't agree on the error code for that
+    const int httpStatus =
+        networkReply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if( (httpStatus == 400 || httpStatus == 404) &&
+            !d->filter.isEmpty() && !d->filter.startsWith('{') )
     {
-        const QJsonObject rs = rooms.value(roomState.jsonKey).toObject();
-        d->roomData.reserve(rs.size());
-        for( auto r = rs.begin(); r != rs.end(); ++r )
+        const QJsonObject json = QJsonDocument::fromJson(
+            networkReply()->peek(networkReply()->bytesAvailable())).object();
+        const QString errCode = json.value("errcode").toString();
+        d->filterRejected =
+            json.value("error").toString().contains("filter", Qt::CaseInsensitive) ||
+            errCode == "M_UNKNOWN" || errCode == "M_NOT_FOUND" ||
+            errCode == "M_INVALID_PARAM";
+    }
+    if( !checkReply() )
+        return;
+
+    if( d->streamParser )
+    {
+        gotPartialReply(); // Pick up whatever has not been read yet
+        if( error() != NoError )
+            return;
+        if( !d->streamParser->atEnd() )
+        {
+            fail( JsonParseError, "The sync response ended prematurely" );
+            return;
+        }
+        if( d->nextBatch.isEmpty() )
         {
-            d->roomData.push_back({r.key(), r.value().toObject(), roomState.enumVal});
+            fail( JsonParseError, "The sync response has no next_batch" );
+            return;
         }
     }
+    else
+        d->enqueue(this, QtConcurrent::run(decodeResponse, networkReply()->readAll()));
 
-    emitResult();
-    qDebug() << objectName() << ": processing complete";
+    d->replyFinished = true;
+    deliverDecoded();
+}
+
+void SyncJob::beforeRetry()
+{
+    // Rooms decoded from the broken reply are still delivered, and the
+    // repeated request starts with the same since token, so some rooms
+    // get the same data twice. Room::updateData() takes care of that:
+    // it drops timeline events and state it already has, and typing
+    // notifications and receipts come to the same result when repeated.
+    if( d->streamParser )
+    {
+        delete d->streamParser;
+        d->streamParser = new SyncStreamParser;
+    }
+}
+
+void SyncJob::deliverDecoded()
+{
+    // Batches may finish decoding in any order; deliver them in the order
+    // they were queued, which is the order of the response.
+    while( !d->pendingBatches.isEmpty() && d->pendingBatches.front()->isFinished() )
+    {
+        if( error() != NoError )
+            return;
+
+        auto watcher = d->pendingBatches.takeFirst();
+        SyncBatch batch = watcher->result();
+        watcher->deleteLater();
+        if( !batch.errorString.isEmpty() )
+        {
+            deleteEvents(batch);
+            fail( JsonParseError, batch.errorString );
+            return;
+        }
+        if( !batch.nextBatch.isEmpty() )
+        {
+            d->nextBatch = batch.nextBatch;
+            emit nextBatchReady(d->nextBatch);
+        }
+        if( d->streamParser )
+        {
+            for( SyncRoomData& roomData: batch.rooms )
+            {
+                emit roomDataReady(roomData);
+                roomData.deleteEvents();
+            }
+        }
+        else
+            d->roomData += batch.rooms;
+    }
+    if( d->replyFinished && d->pendingBatches.isEmpty() && error() == NoError )
+    {
+        emitResult();
+        qDebug() << objectName() << ": processing complete";
+    }
 }
 
 void SyncRoomData::EventList::fromJson(const QJsonObject& roomContents)
@@ -180,3 +433,22 @@ SyncRoomData::SyncRoomData(QString roomId_, const QJsonObject& room_, JoinState
     notificationCount = unread.value("notification_count").toInt();
     qDebug() << "Highlights: " << highlightCount << " Notifications:" << notificationCount;
 }
+
+void SyncRoomData::releaseEvents()
+{
+    state.clear();
+    timeline.clear();
+    ephemeral.clear();
+    accountData.clear();
+    inviteState.clear();
+}
+
+void SyncRoomData::deleteEvents()
+{
+    qDeleteAll(state);
+    qDeleteAll(timeline);
+    qDeleteAll(ephemeral);
+    qDeleteAll(accountData);
+    qDeleteAll(inviteState);
+    releaseEvents();
+}
@@ -53,11 +53,20 @@ namespace QMatrixClient
         int notificationCount;
 
         SyncRoomData(QString roomId_, const QJsonObject& room_, JoinState joinState_);
+
+        /**
+         * Clears the lists without deleting the events, once they have
+         * been taken over by someone else
+         */
+        void releaseEvents();
+        /** Deletes the events that nobody has taken over */
+        void deleteEvents();
     };
 
     class ConnectionData;
     class SyncJob: public BaseJob
     {
+            Q_OBJECT
         public:
             SyncJob(ConnectionData* connection, QString since=QString());
             virtual ~SyncJob();
@@ -66,16 +75,71 @@ namespace QMatrixClient
             void setFullState(bool full);
             void setPresence(QString presence);
             void setTimeout(int timeout);
+            /**
+             * Enables parsing the response while it's being received. In this
+             * mode, each room is emitted with roomDataReady() as soon as its
+             * JSON is complete, and roomData() stays empty.
+             *
+             * In either mode, JSON decoding and construction of events happen
+             * in the global QThreadPool, a task per room; results are
+             * delivered in the thread of the job, in the order of the
+             * response. Whether this pays off depends on the number of cores
+             * and the sizes of rooms; setting the maximal thread count of
+             * the pool to 1 makes decoding serial, for comparison.
+             */
+            void setStreaming(bool streaming);
 
-            QList<SyncRoomData> roomData() const;
+            /**
+             * The job owns the events in the rooms and deletes whatever
+             * is left of them when it's deleted; take the events out of
+             * the lists (Room::updateData() does that) to keep them.
+             */
+            QList<SyncRoomData>& roomData();
             QString nextBatch() const;
+            /**
+             * Whether the job has failed because the server didn't accept
+             * the filter id passed to setFilter(); an inline filter in JSON
+             * can be used instead
+             */
+            bool filterRejected() const;
+
+            /**
+             * Decodes a complete response body the same way as a job that
+             * is not streaming, and waits for the result; the calling
+             * thread takes part in decoding. The caller owns the events in
+             * the rooms. This is what the sync decoding benchmark measures.
+             * @return false if the body is not a valid sync response
+             */
+            static bool decodeBody(const QByteArray& body,
+                                   QList<SyncRoomData>& rooms,
+                                   QString* nextBatch = nullptr);
+
+        signals:
+            /**
+             * Emitted in the streaming mode for each room in the response.
+             * Slots may take the events out of roomData, as with roomData();
+             * the events left in it are deleted after the signal, so this
+             * must not be connected with a queued connection.
+             */
+            void roomDataReady(SyncRoomData& roomData);
+            /**
+             * Emitted as soon as the token for the next sync is known,
+             * which may be long before the rooms are all delivered
+             */
+            void nextBatchReady(const QString& nextBatch);
 
         protected:
             QString apiPath() const override;
             QUrlQuery query() const override;
-            void parseJson(const QJsonDocument& data) override;
+            void beforeRetry() override;
+
+        protected slots:
+            void gotPartialReply() override;
+            void gotReply() override;
 
         private:
+            void deliverDecoded();
+
             class Private;
             Private* d;
     };
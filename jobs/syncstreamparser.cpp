@@ -0,0 +1,197 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "syncstreamparser.h"
+
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonArray>
+
+using namespace QMatrixClient;
+
+// The parser only looks at the first three levels of the response:
+// { "rooms": { "join": { "<room id>": { ...room JSON... } } } }
+static const int RoomDepth = 4;
+
+static QString decodeJsonString(const char* begin, int size)
+{
+    // begin and size include the opening and closing quotes
+    const QByteArray raw = QByteArray::fromRawData(begin, size);
+    if( !raw.contains('\\') )
+        return QString::fromUtf8(begin + 1, size - 2);
+
+    // Let QJsonDocument deal with escape sequences, as these are rare
+    return QJsonDocument::fromJson('[' + raw + ']').array().at(0).toString();
+}
+
+SyncStreamParser::SyncStreamParser()
+    : pos(0), expectKey(false), inString(false), escaped(false)
+    , stringStart(-1), finished(false), roomStart(-1)
+    , roomJoinState(JoinState::Join)
+{
+}
+
+bool SyncStreamParser::feed(const QByteArray& chunk)
+{
+    if( !error.isEmpty() )
+        return false;
+    if( finished )
+        return true; // Trailing whitespace, most likely
+
+    buffer.append(chunk);
+    const char* data = buffer.constData();
+    for( ; pos < buffer.size(); ++pos )
+    {
+        const char c = data[pos];
+        if( inString )
+        {
+            if( escaped )
+                escaped = false;
+            else if( c == '\\' )
+                escaped = true;
+            else if( c == '"' )
+            {
+                inString = false;
+                stringFinished(pos);
+            }
+            continue;
+        }
+
+        switch( c )
+        {
+            case '"':
+                inString = true;
+                stringStart = pos;
+                break;
+            case '{':
+            case '[':
+                if( stack.isEmpty() && c != '{' )
+                    return fail("The sync response is not a JSON object");
+                stack.push_back(c);
+                keys.push_back(QString());
+                expectKey = (c == '{');
+                if( c == '{' && stack.size() == RoomDepth &&
+                        stack[1] == '{' && stack[2] == '{' &&
+                        keys[0] == "rooms" )
+                {
+                    if( keys[1] == "join" )
+                        roomJoinState = JoinState::Join;
+                    else if( keys[1] == "invite" )
+                        roomJoinState = JoinState::Invite;
+                    else if( keys[1] == "leave" )
+                        roomJoinState = JoinState::Leave;
+                    else
+                        break;
+                    roomStart = pos;
+                }
+                break;
+            case '}':
+            case ']':
+                if( stack.isEmpty() || stack.back() != (c == '}' ? '{' : '[') )
+                    return fail("Unbalanced brackets in the sync response");
+                if( stack.size() == RoomDepth && roomStart >= 0 )
+                {
+                    rooms.push_back({ keys[2], roomJoinState,
+                                      buffer.mid(roomStart, pos + 1 - roomStart) });
+                    roomStart = -1;
+                }
+                stack.pop_back();
+                keys.pop_back();
+                expectKey = false;
+                if( stack.isEmpty() )
+                {
+                    finished = true;
+                    ++pos;
+                    compact();
+                    return true;
+                }
+                break;
+            case ':':
+                expectKey = false;
+                break;
+            case ',':
+                expectKey = !stack.isEmpty() && stack.back() == '{';
+                break;
+            default:
+                break; // Whitespace, numbers and literals are not interesting
+        }
+    }
+    compact();
+    return true;
+}
+
+void SyncStreamParser::stringFinished(int end)
+{
+    // Only keys of the upper levels and next_batch matter; everything
+    // deeper is cut out as a whole room or skipped.
+    if( stack.isEmpty() || stack.size() >= RoomDepth || stack.back() != '{' )
+        return;
+
+    if( expectKey )
+        keys.back() = decodeJsonString(buffer.constData() + stringStart,
+                                       end + 1 - stringStart);
+    else if( stack.size() == 1 && keys[0] == "next_batch" )
+        nextBatchValue = decodeJsonString(buffer.constData() + stringStart,
+                                          end + 1 - stringStart);
+}
+
+void SyncStreamParser::compact()
+{
+    int keepFrom = pos;
+    if( inString )
+        keepFrom = stringStart;
+    if( roomStart >= 0 )
+        keepFrom = roomStart;
+    if( keepFrom == 0 )
+        return;
+
+    buffer.remove(0, keepFrom);
+    pos -= keepFrom;
+    if( inString )
+        stringStart -= keepFrom;
+    if( roomStart >= 0 )
+        roomStart -= keepFrom;
+}
+
+bool SyncStreamParser::fail(const char* message)
+{
+    error = message;
+    buffer.clear();
+    return false;
+}
+
+bool SyncStreamParser::atEnd() const
+{
+    return finished;
+}
+
+QString SyncStreamParser::errorString() const
+{
+    return error;
+}
+
+QString SyncStreamParser::nextBatch() const
+{
+    return nextBatchValue;
+}
+
+QList<SyncStreamParser::RoomJson> SyncStreamParser::takeRooms()
+{
+    QList<RoomJson> result;
+    result.swap(rooms);
+    return result;
+}
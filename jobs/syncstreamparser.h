@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef QMATRIXCLIENT_SYNCSTREAMPARSER_H
+#define QMATRIXCLIENT_SYNCSTREAMPARSER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+#include "../joinstate.h"
+
+namespace QMatrixClient
+{
+    /**
+     * @brief An incremental splitter of /sync responses
+     *
+     * The parser is fed with arbitrary chunks of the response body as they
+     * arrive from the network. It doesn't build any JSON tree; instead, it
+     * scans the bytes, keeps track of the nesting and cuts out the JSON
+     * of each room under rooms.join, rooms.invite and rooms.leave as soon
+     * as the room object is closed. Bytes that are no more needed are
+     * dropped from the internal buffer, so the memory footprint is bounded
+     * by the largest room in the response rather than the whole response.
+     */
+    class SyncStreamParser
+    {
+        public:
+            struct RoomJson
+            {
+                QString roomId;
+                JoinState joinState;
+                QByteArray json;
+            };
+
+            SyncStreamParser();
+
+            /**
+             * Consumes the next chunk of the response body.
+             * @return false if the stream is found to be malformed; the parser
+             * should not be used after that.
+             */
+            bool feed(const QByteArray& chunk);
+            /** Whether the top-level JSON object has been closed */
+            bool atEnd() const;
+            QString errorString() const;
+
+            /** next_batch, or an empty string if it's not been seen yet */
+            QString nextBatch() const;
+            /** Returns and forgets rooms that have been completely received */
+            QList<RoomJson> takeRooms();
+
+        private:
+            bool fail(const char* message);
+            void stringFinished(int end);
+            void compact();
+
+            QByteArray buffer;
+            int pos;
+
+            QVector<char> stack;
+            QVector<QString> keys;
+            bool expectKey;
+            bool inString;
+            bool escaped;
+            int stringStart;
+            bool finished;
+            QString error;
+
+            int roomStart;
+            JoinState roomJoinState;
+            QString nextBatchValue;
+            QList<RoomJson> rooms;
+    };
+}
+
+#endif // QMATRIXCLIENT_SYNCSTREAMPARSER_H
@@ -1,4 +1,4 @@
-QT += network
+QT += network concurrent
 CONFIG += c++11
 
 INCLUDEPATH += $$PWD $$PWD/kcoreaddons/src/lib/jobs
@@ -8,9 +8,12 @@ HEADERS += \
     $$PWD/connection.h \
     $$PWD/connectionprivate.h \
     $$PWD/room.h \
+    $$PWD/timeline.h \
+    $$PWD/eventstore.h \
     $$PWD/user.h \
     $$PWD/logmessage.h \
     $$PWD/state.h \
+    $$PWD/filter.h \
     $$PWD/events/event.h \
     $$PWD/events/roommessageevent.h \
     $$PWD/events/roomnameevent.h \
@@ -21,17 +24,21 @@ HEADERS += \
     $$PWD/events/typingevent.h \
     $$PWD/events/receiptevent.h \
     $$PWD/events/unknownevent.h \
+    $$PWD/events/eventarena.h \
     $$PWD/jobs/basejob.h \
     $$PWD/jobs/checkauthmethods.h \
     $$PWD/jobs/passwordlogin.h \
     $$PWD/jobs/postmessagejob.h \
     $$PWD/jobs/postreceiptjob.h \
+    $$PWD/jobs/postfilterjob.h \
     $$PWD/jobs/joinroomjob.h \
     $$PWD/jobs/leaveroomjob.h \
     $$PWD/jobs/roommembersjob.h \
     $$PWD/jobs/roommessagesjob.h \
     $$PWD/jobs/syncjob.h \
+    $$PWD/jobs/syncstreamparser.h \
     $$PWD/jobs/mediathumbnailjob.h \
+    $$PWD/jobs/jobscheduler.h \
     $$PWD/kcoreaddons/src/lib/jobs/kjob.h \
     $$PWD/kcoreaddons/src/lib/jobs/kcompositejob.h \
     $$PWD/kcoreaddons/src/lib/jobs/kjobtrackerinterface.h \
@@ -42,9 +49,12 @@ SOURCES += \
     $$PWD/connection.cpp \
     $$PWD/connectionprivate.cpp \
     $$PWD/room.cpp \
+    $$PWD/timeline.cpp \
+    $$PWD/eventstore.cpp \
     $$PWD/user.cpp \
     $$PWD/logmessage.cpp \
     $$PWD/state.cpp \
+    $$PWD/filter.cpp \
     $$PWD/events/event.cpp \
     $$PWD/events/roommessageevent.cpp \
     $$PWD/events/roomnameevent.cpp \
@@ -55,17 +65,21 @@ SOURCES += \
     $$PWD/events/typingevent.cpp \
     $$PWD/events/receiptevent.cpp \
     $$PWD/events/unknownevent.cpp \
+    $$PWD/events/eventarena.cpp \
     $$PWD/jobs/basejob.cpp \
     $$PWD/jobs/checkauthmethods.cpp \
     $$PWD/jobs/passwordlogin.cpp \
     $$PWD/jobs/postmessagejob.cpp \
     $$PWD/jobs/postreceiptjob.cpp \
+    $$PWD/jobs/postfilterjob.cpp \
     $$PWD/jobs/joinroomjob.cpp \
     $$PWD/jobs/leaveroomjob.cpp \
     $$PWD/jobs/roommembersjob.cpp \
     $$PWD/jobs/roommessagesjob.cpp \
     $$PWD/jobs/syncjob.cpp \
+    $$PWD/jobs/syncstreamparser.cpp \
     $$PWD/jobs/mediathumbnailjob.cpp \
+    $$PWD/jobs/jobscheduler.cpp \
     $$PWD/kcoreaddons/src/lib/jobs/kjob.cpp \
     $$PWD/kcoreaddons/src/lib/jobs/kcompositejob.cpp \
     $$PWD/kcoreaddons/src/lib/jobs/kjobtrackerinterface.cpp \
@@ -18,15 +18,19 @@
 
 #include "room.h"
 
+#include <algorithm>
 #include <array>
 
 #include <QtCore/QHash>
+#include <QtCore/QSet>
 #include <QtCore/QJsonArray>
 #include <QtCore/QStringBuilder> // for efficient string concats (operator%)
 #include <QtCore/QDebug>
 
 #include "connection.h"
+#include "eventstore.h"
 #include "state.h"
+#include "timeline.h"
 #include "user.h"
 #include "events/event.h"
 #include "events/roommessageevent.h"
@@ -46,8 +50,10 @@ class Room::Private
     public:
         /** Map of user names to users. User names potentially duplicate, hence a multi-hashmap. */
         typedef QMultiHash<QString, User*> members_map_t;
+        /** The two users with the lowest ids, except the local user */
+        typedef std::array<User*, 2> top_members_t;
         
-        Private(Room* parent): q(parent) {}
+        Private(Room* parent): q(parent), topMembers{{ nullptr, nullptr }} {}
 
         Room* q;
 
@@ -56,9 +62,26 @@ class Room::Private
 		// This updates the room displayname field (which is the way a room should be shown in the room list)
 		// It should be called whenever the list of members or the room name (m.room.name) or canonical alias change.
         void updateDisplayname();
+        /**
+         * Recomputes topMembers from scratch; the local user could have
+         * got there while it wasn't known (e.g. after loadState())
+         */
+        void localUserChanged();
 
         Connection* connection;
-        QList<Event*> messageEvents;
+        Timeline messageEvents;
+        /** messageEvents as a list, for Room::messageEvents() */
+        mutable QList<Event*> messageEventList;
+        mutable bool messageEventListValid;
+        /** Events collected by processMessageEvent() during a batch */
+        Timeline::page_t pendingMessages;
+        bool collectingMessages;
+        /** To be called on each change of messageEvents */
+        void timelineChanged()
+        {
+            messageEventList.clear();
+            messageEventListValid = false;
+        }
         QString id;
         QStringList aliases;
         QString canonicalAlias;
@@ -69,17 +92,88 @@ class Room::Private
         int highlightCount;
         int notificationCount;
         members_map_t membersMap;
+        /** The same users as in membersMap, for lookups that don't need names */
+        QSet<User*> members;
+        /**
+         * Disambiguated names of members, filled by roomMembername() and
+         * invalidated when the set of a member's namesakes changes
+         */
+        mutable QHash<User*, QString> memberNames;
+        /** Kept up to date on each change of membersMap */
+        top_members_t topMembers;
         QList<User*> usersTyping;
         QList<User*> membersLeft;
         QHash<User*, QString> lastReadEvent;
         QString prevBatch;
         RoomMessagesJob* roomMessagesJob;
+        /** The latest state events, by event type and state key */
+        QHash<QPair<int, QString>, Event*> currentState;
+        /** Ids of the events in currentState */
+        QSet<QString> currentStateIds;
+        /**
+         * Events of currentState that the room owns and that are not in
+         * the timeline; they are deleted when replaced
+         */
+        QSet<Event*> detachedState;
+        /** Events of the timeline by their ids */
+        QHash<QString, Event*> eventsById;
+        /**
+         * Tokens to paginate back from a given event (prev_batch of sync
+         * batches, end of backfill pages), by the event id
+         */
+        QHash<QString, QString> timelineTokens;
+
+        /** How many timeline events toJson() saves, at least */
+        static const int SavedTimelineLimit = 20;
+
+        void setCurrentState(Event* event, QString stateKey = QString());
+        /**
+         * Checks whether the event (or another one with the same id) is
+         * already the current state; a retried sync brings the same state
+         * again, and it shouldn't be applied twice.
+         */
+        bool isCurrentState(const Event* event) const;
+
+        /** Checks whether the room already has an event with the same id */
+        bool isDuplicate(const Event* event) const;
+        /**
+         * Deletes events that the room already has (or that occur twice in
+         * the list) and returns the rest; sync and backfill may overlap.
+         * The events must have been taken over by the room.
+         */
+        QList<Event*> dropDuplicates(const QList<Event*>& events) const;
+
+        bool newMessageSignalEnabled;
+        /**
+         * Emits aboutToInsertMessages() or aboutToResetMessages() for
+         * the events; returns the position to pass to messagesAdded()
+         */
+        int aboutToAddMessages(const QList<Event*>& events);
+        /** Emits messagesInserted() or messagesReset(), and newMessage() */
+        void messagesAdded(const QList<Event*>& events, int position);
+        /** Adds events that are known to be new, with the signals above */
+        void insertMessages(const QList<Event*>& events);
+
+        /** Saved history that hasn't been paged in yet */
+        EventStore historyStore;
+        /** How many events getPreviousContent() takes from historyStore */
+        static const int HistoryPageSize = 50;
+
+        /** Returns false if there's nothing left in the store */
+        bool loadFromHistoryStore();
+        /** Where the history store is, even if it's not open */
+        QString historyPath;
+        /** Saves events evicted from the timeline to the history store */
+        bool evictToStore(const Timeline::page_t& events);
+        int timelineLimit;
         
         // Convenience methods to work with the membersMap and usersLeft. addMember()
         // and removeMember() emit respective Room:: signals after a succesful
         // operation.
         //void inviteUser(User* u); // We might get it at some point in time.
         void addMember(User* u);
+        /** Like addMember() for many users, with one usersAdded() signal */
+        void addMembers(const QList<User*>& users);
         bool hasMember(User* u) const;
         // You can't identify a single user by displayname, only by id
         User* member(QString id) const;
@@ -90,7 +184,18 @@ class Room::Private
 
     private:
         QString calculateDisplayname() const;
-        QString roomNameFromMemberNames(const QList<User*>& userlist) const;
+        QString roomNameFromMemberNames(const top_members_t& topTwo,
+                                        int userCount) const;
+        /** Puts u in place in topTwo if it belongs there */
+        void considerTopMember(top_members_t& topTwo, User* u) const;
+        template <typename ContT>
+        top_members_t findTopMembers(const ContT& users) const
+        {
+            top_members_t topTwo {{ nullptr, nullptr }};
+            for (User* u: users)
+                considerTopMember(topTwo, u);
+            return topTwo;
+        }
 
         void insertMemberIntoMap(User* u);
         void removeMemberFromMap(QString username, User* u);
@@ -103,6 +208,16 @@ Room::Room(Connection* connection, QString id)
     d->connection = connection;
     d->joinState = JoinState::Join;
     d->roomMessagesJob = nullptr;
+    d->highlightCount = 0;
+    d->notificationCount = 0;
+    d->timelineLimit = 0;
+    d->newMessageSignalEnabled = false;
+    d->messageEventListValid = false;
+    d->collectingMessages = false;
+    connect( connection, &Connection::connected,
+             this, [this] () { d->localUserChanged(); });
+    connect( connection, &Connection::reconnected,
+             this, [this] () { d->localUserChanged(); });
     qDebug() << "New Room:" << id;
 
     //connection->getMembers(this); // I don't think we need this anymore in r0.0.1
@@ -111,6 +226,9 @@ Room::Room(Connection* connection, QString id)
 Room::~Room()
 {
     qDebug() << "deconstructing room" << this;
+    for( Event* e: d->messageEvents )
+        delete e;
+    qDeleteAll(d->detachedState);
     delete d;
 }
 
@@ -119,7 +237,22 @@ QString Room::id() const
     return d->id;
 }
 
-QList< Event* > Room::messageEvents() const
+Event* Room::findEvent(const QString& eventId) const
+{
+    return d->eventsById.value(eventId, nullptr);
+}
+
+const QList<Event*>& Room::messageEvents() const
+{
+    if( !d->messageEventListValid )
+    {
+        d->messageEventList = d->messageEvents.toList();
+        d->messageEventListValid = true;
+    }
+    return d->messageEventList;
+}
+
+const Timeline& Room::timeline() const
 {
     return d->messageEvents;
 }
@@ -218,25 +351,42 @@ void Room::Private::insertMemberIntoMap(User *u)
 {
     QList<User*> namesakes = membersMap.values(u->name());
     membersMap.insert(u->name(), u);
+    members.insert(u);
+    considerTopMember(topMembers, u);
     // If there is exactly one namesake of the added user, signal member renaming
     // for that other one because the two should be disambiguated now.
     if (namesakes.size() == 1)
+    {
+        memberNames.remove(namesakes[0]);
         emit q->memberRenamed(namesakes[0]);
+    }
 
-    updateDisplayname();
+    // Members only matter for the displayname if there's no explicit name
+    if (name.isEmpty() && canonicalAlias.isEmpty())
+        updateDisplayname();
 }
 
 void Room::Private::removeMemberFromMap(QString username, User* u)
 {
     membersMap.remove(username, u);
+    members.remove(u);
+    memberNames.remove(u);
+    // Only if one of the top members is gone, the next one has to be found
+    if (u == topMembers[0] || u == topMembers[1])
+        topMembers = findTopMembers(membersMap);
     // If there was one namesake besides the removed user, signal member renaming
     // for it because it doesn't need to be disambiguated anymore.
     // TODO: Think about left users.
     QList<User*> formerNamesakes = membersMap.values(username);
     if (formerNamesakes.size() == 1)
+    {
+        memberNames.remove(formerNamesakes[0]);
         emit q->memberRenamed(formerNamesakes[0]);
+    }
 
-    updateDisplayname();
+    // Members only matter for the displayname if there's no explicit name
+    if (name.isEmpty() && canonicalAlias.isEmpty())
+        updateDisplayname();
 }
 
 void Room::Private::addMember(User *u)
@@ -249,9 +399,54 @@ void Room::Private::addMember(User *u)
     }
 }
 
+void Room::Private::addMembers(const QList<User*>& users)
+{
+    QList<User*> added;
+    QSet<QString> addedNames;
+    for (User* u: users)
+    {
+        if (hasMember(u))
+            continue;
+        membersMap.insert(u->name(), u);
+        members.insert(u);
+        considerTopMember(topMembers, u);
+        connect(u, &User::nameChanged, q, &Room::userRenamed);
+        added.push_back(u);
+        addedNames.insert(u->name());
+    }
+    if (added.isEmpty())
+        return;
+
+    // Disambiguate once per name, rather than once per user: as in
+    // insertMemberIntoMap(), a member that had no namesakes before and
+    // has some now is renamed.
+    const QSet<User*> addedSet = added.toSet();
+    for (const QString& username: addedNames)
+    {
+        const QList<User*> namesakes = membersMap.values(username);
+        User* formerOnly = nullptr;
+        int formerCount = 0;
+        for (User* u: namesakes)
+            if (!addedSet.contains(u))
+            {
+                formerOnly = u;
+                ++formerCount;
+            }
+        if (formerCount == 1)
+        {
+            memberNames.remove(formerOnly);
+            emit q->memberRenamed(formerOnly);
+        }
+    }
+
+    if (name.isEmpty() && canonicalAlias.isEmpty())
+        updateDisplayname();
+    emit q->usersAdded(added);
+}
+
 bool Room::Private::hasMember(User* u) const
 {
-    return membersMap.values(u->name()).contains(u);
+    return members.contains(u);
 }
 
 User* Room::Private::member(QString id) const
@@ -262,7 +457,10 @@ User* Room::Private::member(QString id) const
 
 void Room::Private::renameMember(User* u, QString oldName)
 {
-    if (hasMember(u))
+    if (!hasMember(u))
+        return;
+
+    if (membersMap.contains(u->name(), u))
     {
         qWarning() << "Room::Private::renameMember(): the user "
                    << u->name()
@@ -270,7 +468,7 @@ void Room::Private::renameMember(User* u, QString oldName)
         return;
     }
 
-    if (membersMap.values(oldName).contains(u))
+    if (membersMap.contains(oldName, u))
     {
         removeMemberFromMap(oldName, u);
         insertMemberIntoMap(u);
@@ -300,28 +498,35 @@ QString Room::roomMembername(User *u) const
 {
     // See the CS spec, section 11.2.2.3
 
+    auto cached = d->memberNames.constFind(u);
+    if (cached != d->memberNames.constEnd())
+        return *cached;
+
     QString username = u->name();
     if (username.isEmpty())
-        return u->id();
-
-    // Get the list of users with the same display name. Most likely,
+        username = u->id();
+    // Get the number of users with the same display name. Most likely,
     // there'll be one, but there's a chance there are more.
-    auto namesakes = d->membersMap.values(username);
-    if (namesakes.size() == 1)
-        return username;
-
-    // We expect a user to be a member of the room - but technically it is
-    // possible to invoke roomMemberName() even for non-members. In such case
-    // we return the name _with_ id, to stay on a safe side.
-    if ( !namesakes.contains(u) )
+    else if (d->membersMap.count(username) != 1)
     {
-        qWarning()
-            << "Room::roomMemberName(): user" << u->id()
-            << "is not a member of the room" << id();
+        // We expect a user to be a member of the room - but technically it is
+        // possible to invoke roomMemberName() even for non-members. In such case
+        // we return the name _with_ id, to stay on a safe side.
+        if ( !d->hasMember(u) )
+        {
+            qWarning()
+                << "Room::roomMemberName(): user" << u->id()
+                << "is not a member of the room" << id();
+        }
+
+        // In case of more than one namesake, disambiguate with user id.
+        username = username % " <" % u->id() % ">";
     }
 
-    // In case of more than one namesake, disambiguate with user id.
-    return username % " <" % u->id() % ">";
+    // Only members are cached, as only their namesakes are tracked
+    if (d->hasMember(u))
+        d->memberNames.insert(u, username);
+    return username;
 }
 
 QString Room::roomMembername(QString userId) const
@@ -331,41 +536,149 @@ QString Room::roomMembername(QString userId) const
 
 void Room::addMessage(Event* event)
 {
+    if( d->isDuplicate(event) )
+    {
+        delete event;
+        return;
+    }
+    const int position = d->aboutToAddMessages({ event });
     processMessageEvent(event);
-    emit newMessage(event);
+    d->messagesAdded({ event }, position);
     //d->addState(event);
 }
 
+void Room::addMessages(const QList<Event*>& events)
+{
+    d->insertMessages(d->dropDuplicates(events));
+}
+
+void Room::Private::insertMessages(const QList<Event*>& events)
+{
+    if( events.isEmpty() )
+        return;
+    const int position = aboutToAddMessages(events);
+    q->processMessageEvents(events);
+    messagesAdded(events, position);
+}
+
+void Room::setNewMessageSignalEnabled(bool enable)
+{
+    d->newMessageSignalEnabled = enable;
+}
+
+bool Room::isNewMessageSignalEnabled() const
+{
+    return d->newMessageSignalEnabled;
+}
+
+int Room::Private::aboutToAddMessages(const QList<Event*>& events)
+{
+    auto range = std::minmax_element(events.begin(), events.end(),
+        [](const Event* a, const Event* b) {
+            return a->timestampMsecs() < b->timestampMsecs();
+        });
+    const int position = messageEvents.insertionPoint(
+        (*range.first)->timestampMsecs(), (*range.second)->timestampMsecs());
+    if( position >= 0 )
+        emit q->aboutToInsertMessages(position, events.size());
+    else
+        emit q->aboutToResetMessages();
+    return position;
+}
+
+void Room::Private::messagesAdded(const QList<Event*>& events, int position)
+{
+    if( position >= 0 )
+        emit q->messagesInserted(position, events.size());
+    else
+        emit q->messagesReset();
+
+    if( newMessageSignalEnabled )
+        for( Event* event: events )
+            emit q->newMessage(event);
+}
+
 void Room::addInitialState(State* state)
 {
     processStateEvent(state->event());
 }
 
-void Room::updateData(const SyncRoomData& data)
+void Room::addInitialStates(const QList<State*>& states)
 {
+    QList<User*> joined;
+    joined.reserve(states.size());
+    for( State* state: states )
+    {
+        Event* event = state->event();
+        if( event->type() != EventType::RoomMember )
+        {
+            processStateEvent(event);
+            continue;
+        }
+        // Same as in processStateEvent(), except that joining users are
+        // collected to be added all at once
+        RoomMemberEvent* memberEvent = static_cast<RoomMemberEvent*>(event);
+        d->setCurrentState(event, memberEvent->userId());
+        User* u = d->connection->user(memberEvent->userId());
+        u->processEvent(event);
+        if( memberEvent->membership() == MembershipType::Join )
+            joined.push_back(u);
+        else if( memberEvent->membership() == MembershipType::Leave )
+            d->removeMember(u);
+    }
+    d->addMembers(joined);
+}
+
+void Room::updateData(SyncRoomData& data)
+{
+    // Take over the events before anything can delete them
+    const QList<Event*> stateEvents = data.state;
+    const QList<Event*> newEvents = data.timeline;
+    const QList<Event*> ephemeralEvents = data.ephemeral;
+    data.state.clear();
+    data.timeline.clear();
+    data.ephemeral.clear();
+
     if( d->prevBatch.isEmpty() )
         d->prevBatch = data.timelinePrevBatch;
+    // The token is removed along with the event, see trimTimeline()
+    if( !newEvents.isEmpty() && !newEvents.front()->id().isEmpty() &&
+            !data.timelinePrevBatch.isEmpty() )
+        d->timelineTokens.insert(newEvents.front()->id(), data.timelinePrevBatch);
     setJoinState(data.joinState);
 
-    for( Event* stateEvent: data.state )
+    for( Event* stateEvent: stateEvents )
     {
+        if( d->isCurrentState(stateEvent) )
+        {
+            delete stateEvent;
+            continue;
+        }
         processStateEvent(stateEvent);
+        if( d->isCurrentState(stateEvent) )
+            d->detachedState.insert(stateEvent);
+        else
+            delete stateEvent;
     }
 
-    for( Event* timelineEvent: data.timeline )
+    const QList<Event*> timelineEvents = d->dropDuplicates(newEvents);
+    d->insertMessages(timelineEvents);
+    for( Event* timelineEvent: timelineEvents )
     {
-
-        processMessageEvent(timelineEvent);
-        emit newMessage(timelineEvent);
         // State changes can arrive in a timeline event - try to check those.
-        processStateEvent(timelineEvent);
+        if( !d->isCurrentState(timelineEvent) )
+            processStateEvent(timelineEvent);
     }
 
-    for( Event* ephemeralEvent: data.ephemeral )
+    for( Event* ephemeralEvent: ephemeralEvents )
     {
         processEphemeralEvent(ephemeralEvent);
+        delete ephemeralEvent;
     }
 
+    if( d->timelineLimit > 0 )
+        trimTimeline(d->timelineLimit);
+
     if( data.highlightCount != d->highlightCount )
     {
         d->highlightCount = data.highlightCount;
@@ -383,20 +696,162 @@ void Room::getPreviousContent()
     d->getPreviousContent();
 }
 
+bool Room::saveHistory(const QString& path) const
+{
+    return EventStore::write(path, d->messageEvents, d->prevBatch);
+}
+
+bool Room::loadHistory(const QString& path)
+{
+    // Evicted events are saved from their original JSON
+    Event::setKeepOriginalJson(true);
+    d->historyPath = path;
+    return d->historyStore.open(path);
+}
+
+void Room::setTimelineLimit(int maxEvents)
+{
+    d->timelineLimit = maxEvents;
+}
+
+int Room::timelineLimit() const
+{
+    return d->timelineLimit;
+}
+
+int Room::trimTimeline(int maxEvents)
+{
+    const Timeline& timeline = d->messageEvents;
+    const int excess = timeline.size() - std::max(maxEvents, 0);
+    if( excess <= 0 )
+        return 0;
+
+    // Find the first event, at or after the excess, that has a token to
+    // paginate back from; there's no need for it if there's a store.
+    int count = 0;
+    QString token;
+    auto it = timeline.begin();
+    for( ; it != timeline.end(); ++it, ++count )
+    {
+        if( count < excess )
+            continue;
+        if( !d->historyPath.isEmpty() )
+            break;
+        auto tokenIt = d->timelineTokens.find((*it)->id());
+        if( tokenIt != d->timelineTokens.end() )
+        {
+            token = *tokenIt;
+            break;
+        }
+    }
+    if( it == timeline.end() )
+        return 0;
+
+    if( !d->historyPath.isEmpty() )
+    {
+        // Save the events before anything is removed, so that nothing
+        // changes if saving fails
+        Timeline::page_t toSave;
+        toSave.reserve(count);
+        for( auto it = timeline.begin(); toSave.size() < count; ++it )
+            toSave.push_back(*it);
+        if( !d->evictToStore(toSave) )
+            return 0;
+    }
+    else
+        d->prevBatch = token;
+
+    emit aboutToEvictMessages(count);
+    const Timeline::page_t evicted = d->messageEvents.takeFront(count);
+    d->timelineChanged();
+
+    // State events stay alive for as long as they are the current state
+    QSet<Event*> stateEvents;
+    stateEvents.reserve(d->currentState.size());
+    for( Event* e: d->currentState )
+        stateEvents.insert(e);
+    for( Event* e: evicted )
+    {
+        d->eventsById.remove(e->id());
+        d->timelineTokens.remove(e->id());
+        if( stateEvents.contains(e) )
+            d->detachedState.insert(e);
+        else
+            delete e;
+    }
+    emit messagesEvicted(count);
+    qDebug() << "Room" << id() << ":" << count << "event(s) evicted";
+    return count;
+}
+
+bool Room::Private::evictToStore(const Timeline::page_t& events)
+{
+    if( !historyStore.isOpen() )
+    {
+        // Whatever was in the file has been paged in, so it's fine to
+        // overwrite it; prevBatch leads to events before the evicted ones.
+        return EventStore::write(historyPath, events, prevBatch) &&
+                historyStore.open(historyPath);
+    }
+
+    // Events up to the newest stored one have been paged in from the store
+    const qint64 newest = historyStore.size() > 0 ?
+        historyStore.timestamp(historyStore.size() - 1) : 0;
+    Timeline::page_t newEvents;
+    for( Event* e: events )
+        if( e->timestampMsecs() > newest )
+            newEvents.push_back(e);
+    return newEvents.isEmpty() || historyStore.append(newEvents);
+}
+
+bool Room::Private::loadFromHistoryStore()
+{
+    if( !historyStore.isOpen() )
+        return false;
+
+    // Only events older than anything in the timeline are left in the store
+    int end = historyStore.size();
+    if( !messageEvents.isEmpty() )
+        end = historyStore.lowerBound(messageEvents.front()->timestampMsecs());
+    const int begin = std::max(0, end - HistoryPageSize);
+    QList<Event*> events;
+    events.reserve(end - begin);
+    for( int i = end - 1; i >= begin; --i )
+    {
+        if( Event* event = historyStore.load(i) )
+            events.push_back(event);
+    }
+    q->addMessages(events);
+    if( begin > 0 )
+        return true;
+
+    // The store is exhausted; continue from where it was saved
+    if( !historyStore.prevBatch().isEmpty() )
+    {
+        prevBatch = historyStore.prevBatch();
+        if( !messageEvents.isEmpty() )
+            timelineTokens.insert(messageEvents.front()->id(), prevBatch);
+    }
+    historyStore.close();
+    return end > begin;
+}
+
 void Room::Private::getPreviousContent()
 {
+    if( loadFromHistoryStore() )
+        return;
+
     if( !roomMessagesJob )
     {
         roomMessagesJob = connection->getMessages(q, prevBatch);
         connect( roomMessagesJob, &RoomMessagesJob::result, [=]() {
             if( !roomMessagesJob->error() )
             {
-                for( Event* event: roomMessagesJob->events() )
-                {
-                    q->processMessageEvent(event);
-                    emit q->newMessage(event);
-                }
+                q->addMessages(roomMessagesJob->releaseEvents());
                 prevBatch = roomMessagesJob->end();
+                // Allows trimTimeline() to cut the timeline here
+                if( !messageEvents.isEmpty() )
+                    timelineTokens.insert(messageEvents.front()->id(), prevBatch);
             }
             roomMessagesJob = nullptr;
         });
@@ -410,13 +865,86 @@ Connection* Room::connection() const
 
 void Room::processMessageEvent(Event* event)
 {
-    d->messageEvents.insert(findInsertionPos(d->messageEvents, event), event);
+    if( !event->id().isEmpty() )
+        d->eventsById.insert(event->id(), event);
+    if( d->collectingMessages )
+    {
+        d->pendingMessages.push_back(event);
+        return;
+    }
+    d->messageEvents.insert(event);
+    d->timelineChanged();
+}
+
+void Room::processMessageEvents(const QList<Event*>& events)
+{
+    // Overrides of processMessageEvent() still see every event
+    d->collectingMessages = true;
+    d->pendingMessages.reserve(events.size());
+    for( Event* event: events )
+        processMessageEvent(event);
+    d->collectingMessages = false;
+
+    Timeline::page_t batch;
+    batch.swap(d->pendingMessages);
+    if( batch.isEmpty() )
+        return;
+    d->messageEvents.merge(batch);
+    d->timelineChanged();
+}
+
+bool Room::Private::isDuplicate(const Event* event) const
+{
+    return !event->id().isEmpty() && eventsById.contains(event->id());
+}
+
+QList<Event*> Room::Private::dropDuplicates(const QList<Event*>& events) const
+{
+    QList<Event*> result;
+    result.reserve(events.size());
+    QSet<QString> batchIds;
+    for( Event* event: events )
+    {
+        const QString eventId = event->id();
+        if( !eventId.isEmpty() &&
+                (eventsById.contains(eventId) || batchIds.contains(eventId)) )
+        {
+            qDebug() << "Room" << id << ": dropping duplicate event" << eventId;
+            delete event;
+            continue;
+        }
+        batchIds.insert(eventId);
+        result.push_back(event);
+    }
+    return result;
+}
+
+void Room::Private::setCurrentState(Event* event, QString stateKey)
+{
+    Event*& current = currentState[qMakePair(int(event->type()), stateKey)];
+    if( current == event )
+        return;
+    if( current )
+    {
+        currentStateIds.remove(current->id());
+        // Events from addInitialState() are not the room's to delete
+        if( detachedState.remove(current) )
+            delete current;
+    }
+    current = event;
+    currentStateIds.insert(event->id());
+}
+
+bool Room::Private::isCurrentState(const Event* event) const
+{
+    return !event->id().isEmpty() && currentStateIds.contains(event->id());
 }
 
 void Room::processStateEvent(Event* event)
 {
     if( event->type() == EventType::RoomName )
     {
+        d->setCurrentState(event);
         if (RoomNameEvent* nameEvent = static_cast<RoomNameEvent*>(event))
         {
             d->name = nameEvent->name();
@@ -432,6 +960,7 @@ void Room::processStateEvent(Event* event)
     if( event->type() == EventType::RoomAliases )
     {
         RoomAliasesEvent* aliasesEvent = static_cast<RoomAliasesEvent*>(event);
+        d->setCurrentState(event);
         d->aliases = aliasesEvent->aliases();
         qDebug() << "room aliases:" << d->aliases;
         // No displayname update - aliases are not used to render a displayname
@@ -440,6 +969,7 @@ void Room::processStateEvent(Event* event)
     if( event->type() == EventType::RoomCanonicalAlias )
     {
         RoomCanonicalAliasEvent* aliasEvent = static_cast<RoomCanonicalAliasEvent*>(event);
+        d->setCurrentState(event);
         d->canonicalAlias = aliasEvent->alias();
         qDebug() << "room canonical alias:" << d->canonicalAlias;
         d->updateDisplayname();
@@ -448,12 +978,14 @@ void Room::processStateEvent(Event* event)
     if( event->type() == EventType::RoomTopic )
     {
         RoomTopicEvent* topicEvent = static_cast<RoomTopicEvent*>(event);
+        d->setCurrentState(event);
         d->topic = topicEvent->topic();
         emit topicChanged();
     }
     if( event->type() == EventType::RoomMember )
     {
         RoomMemberEvent* memberEvent = static_cast<RoomMemberEvent*>(event);
+        d->setCurrentState(event, memberEvent->userId());
         User* u = d->connection->user(memberEvent->userId());
         u->processEvent(event);
         if( memberEvent->membership() == MembershipType::Join )
@@ -472,12 +1004,17 @@ void Room::processEphemeralEvent(Event* event)
     if( event->type() == EventType::Typing )
     {
         TypingEvent* typingEvent = static_cast<TypingEvent*>(event);
-        d->usersTyping.clear();
+        QList<User*> usersTyping;
         for( const QString& user: typingEvent->users() )
         {
-            d->usersTyping.append(d->connection->user(user));
+            usersTyping.append(d->connection->user(user));
+        }
+        // A retried sync repeats the same notification
+        if( usersTyping != d->usersTyping )
+        {
+            d->usersTyping = usersTyping;
+            emit typingChanged();
         }
-        emit typingChanged();
     }
     if( event->type() == EventType::Receipt )
     {
@@ -485,50 +1022,126 @@ void Room::processEphemeralEvent(Event* event)
         for( QString eventId: receiptEvent->events() )
         {
             QList<Receipt> receipts = receiptEvent->receiptsForEvent(eventId);
+            const Event* readEvent = findEvent(eventId);
             for( Receipt r: receipts )
             {
-                d->lastReadEvent.insert(d->connection->user(r.userId), eventId);
+                // Don't let a stale receipt move the read marker back
+                User* user = d->connection->user(r.userId);
+                const Event* lastRead = findEvent(d->lastReadEvent.value(user));
+                if( readEvent && lastRead &&
+                        readEvent->timestampMsecs() < lastRead->timestampMsecs() )
+                    continue;
+                d->lastReadEvent.insert(user, eventId);
             }
         }
     }
 }
 
-QString Room::Private::roomNameFromMemberNames(const QList<User *> &userlist) const
+template <typename IterT>
+static QJsonArray eventsToJson(IterT from, IterT to)
+{
+    // Events received before Event::setKeepOriginalJson() was turned on
+    // have nothing to save
+    QJsonArray events;
+    for (; from != to; ++from)
+    {
+        const QJsonObject json = (*from)->originalJsonObject();
+        if( !json.isEmpty() )
+            events.append(json);
+    }
+    return events;
+}
+
+QJsonObject Room::toJson() const
+{
+    const QList<Event*> stateEvents = d->currentState.values();
+    QJsonObject state;
+    state.insert("events", eventsToJson(stateEvents.begin(), stateEvents.end()));
+
+    QJsonObject result;
+    if (d->joinState == JoinState::Invite)
+    {
+        result.insert("invite_state", state);
+        return result;
+    }
+    result.insert("state", state);
+
+    // Save the tail of the timeline cut at the start of some sync batch,
+    // so that the batch's prev_batch leads exactly to the saved events.
+    // If there's no such point, the whole timeline goes with prevBatch.
+    const Timeline& timelineEvents = d->messageEvents;
+    Timeline::const_iterator tailStart = timelineEvents.begin();
+    QString tailToken = d->prevBatch;
+    int tailSize = 0;
+    for (auto it = timelineEvents.end(); it != timelineEvents.begin();)
+    {
+        --it;
+        ++tailSize;
+        if (it == timelineEvents.begin())
+            break;
+        auto tokenIt = d->timelineTokens.find((*it)->id());
+        if (tokenIt == d->timelineTokens.end())
+            continue;
+        tailStart = it;
+        tailToken = *tokenIt;
+        if (tailSize >= Private::SavedTimelineLimit)
+            break;
+    }
+    QJsonObject timeline;
+    timeline.insert("events", eventsToJson(tailStart, timelineEvents.end()));
+    timeline.insert("prev_batch", tailToken);
+    timeline.insert("limited", tailStart != timelineEvents.begin());
+    result.insert("timeline", timeline);
+
+    QJsonObject unread;
+    unread.insert("highlight_count", d->highlightCount);
+    unread.insert("notification_count", d->notificationCount);
+    result.insert("unread_notifications", unread);
+    return result;
+}
+
+void Room::Private::considerTopMember(top_members_t& topTwo, User* u) const
+{
+    // Filter out the "me" user so that it never hits the room name
+    if (u == connection->user())
+        return;
+
+    if (!topTwo[0] || u->id() < topTwo[0]->id())
+    {
+        topTwo[1] = topTwo[0];
+        topTwo[0] = u;
+    }
+    else if (u != topTwo[0] && (!topTwo[1] || u->id() < topTwo[1]->id()))
+        topTwo[1] = u;
+}
+
+QString Room::Private::roomNameFromMemberNames(const top_members_t& topTwo,
+                                               int userCount) const
 {
     // This is part 3(i,ii,iii) in the room displayname algorithm described
     // in the CS spec (see also Room::Private::updateDisplayname() ).
     // The spec requires to sort users lexicographically by state_key (user id)
     // and use disambiguated display names of two topmost users excluding
-    // the current one to render the name of the room.
-
-    // std::array is the leanest C++ container
-    std::array<User*, 2> first_two { nullptr, nullptr };
-    std::partial_sort_copy(
-        userlist.begin(), userlist.end(),
-        first_two.begin(), first_two.end(),
-        [this](const User* u1, const User* u2) {
-            // Filter out the "me" user so that it never hits the room name
-            return u1 != connection->user() && u1->id() < u2->id();
-        }
-    );
+    // the current one to render the name of the room. topTwo is maintained
+    // along with the list of users, so this doesn't depend on userCount.
 
-    // i. One-on-one chat. first_two[1] == connection->user() in this case.
-    if (userlist.size() == 2)
-        return q->roomMembername(first_two[0]);
+    // i. One-on-one chat. The other user is the current one in this case.
+    if (userCount == 2 && topTwo[0])
+        return q->roomMembername(topTwo[0]);
 
     // ii. Two users besides the current one.
-    if (userlist.size() == 3)
+    if (userCount == 3 && topTwo[1])
         return tr("%1 and %2")
-                .arg(q->roomMembername(first_two[0]))
-                .arg(q->roomMembername(first_two[1]));
+                .arg(q->roomMembername(topTwo[0]))
+                .arg(q->roomMembername(topTwo[1]));
 
     // iii. More users.
-    if (userlist.size() > 3)
+    if (userCount > 3 && topTwo[0])
         return tr("%1 and %L2 others")
-                .arg(q->roomMembername(first_two[0]))
-                .arg(userlist.size() - 3);
+                .arg(q->roomMembername(topTwo[0]))
+                .arg(userCount - 3);
 
-    // userlist.size() < 2 - apparently, there's only current user in the room
+    // userCount < 2 - apparently, there's only current user in the room
     return QString();
 }
 
@@ -553,12 +1166,16 @@ QString Room::Private::calculateDisplayname() const
         return canonicalAlias;
 
     // 3. Room members
-    QString topMemberNames = roomNameFromMemberNames(membersMap.values());
+    QString topMemberNames =
+        roomNameFromMemberNames(topMembers, membersMap.size());
     if (!topMemberNames.isEmpty())
         return topMemberNames;
 
     // 4. Users that previously left the room
-    topMemberNames = roomNameFromMemberNames(membersLeft);
+    // This one is not maintained incrementally: it's only needed for
+    // empty rooms, and these don't have many users to go through.
+    topMemberNames = roomNameFromMemberNames(findTopMembers(membersLeft),
+                                             membersLeft.size());
     if (!topMemberNames.isEmpty())
         return tr("Empty room (was: %1)").arg(topMemberNames);
 
@@ -570,6 +1187,12 @@ QString Room::Private::calculateDisplayname() const
     //    displayname = aliases.at(0);
 }
 
+void Room::Private::localUserChanged()
+{
+    topMembers = findTopMembers(membersMap);
+    updateDisplayname();
+}
+
 void Room::Private::updateDisplayname()
 {
     const QString old_name = displayname;
@@ -32,6 +32,7 @@ namespace QMatrixClient
     class State;
     class Connection;
     class User;
+    class Timeline;
 
     class Room: public QObject
     {
@@ -41,7 +42,21 @@ namespace QMatrixClient
             virtual ~Room();
 
             Q_INVOKABLE QString id() const;
-            Q_INVOKABLE QList<Event*> messageEvents() const;
+            /**
+             * Finds an event in the timeline by its id; use
+             * timeline().find() to get its position.
+             * @return the event, or nullptr if the room doesn't have it
+             */
+            Q_INVOKABLE Event* findEvent(const QString& eventId) const;
+            /**
+             * The timeline as a list. The list is made on the first call
+             * after the timeline changes and kept until the next change,
+             * so repeated calls are cheap. Prefer timeline() anyway; use
+             * timeline().toList() for a copy of your own.
+             */
+            Q_INVOKABLE const QList<Event*>& messageEvents() const;
+            /** The timeline, sorted by timestamp */
+            const Timeline& timeline() const;
             Q_INVOKABLE QString name() const;
             Q_INVOKABLE QStringList aliases() const;
             Q_INVOKABLE QString canonicalAlias() const;
@@ -64,14 +79,100 @@ namespace QMatrixClient
              */
             Q_INVOKABLE QString roomMembername(QString userId) const;
 
+            /**
+             * The room takes over the event, and deletes it right away
+             * if it already has an event with the same id
+             */
             Q_INVOKABLE void addMessage( Event* event );
+            /**
+             * Adds several events at once, taking them over as addMessage()
+             * does; see processMessageEvents()
+             */
+            Q_INVOKABLE void addMessages( const QList<Event*>& events );
             Q_INVOKABLE void addInitialState( State* state );
-            Q_INVOKABLE void updateData( const SyncRoomData& data );
+            /**
+             * @brief Adds a batch of state, such as the result of /members
+             *
+             * Members are added in one go and get a single usersAdded()
+             * instead of userAdded() for each of them; the displayname
+             * is updated once at the end.
+             */
+            Q_INVOKABLE void addInitialStates( const QList<State*>& states );
+            /**
+             * @brief Applies a sync response for the room
+             *
+             * The room takes the events out of data.state, data.timeline
+             * and data.ephemeral and becomes their owner; the rest of
+             * the events stay with the caller.
+             */
+            Q_INVOKABLE void updateData( SyncRoomData& data );
             Q_INVOKABLE void setJoinState( JoinState state );
 
+            /**
+             * @brief Enables newMessage() for each added event
+             *
+             * Off by default; messagesInserted() and messagesReset() cover
+             * whole batches of events and are much cheaper to handle.
+             */
+            void setNewMessageSignalEnabled(bool enable);
+            bool isNewMessageSignalEnabled() const;
+
             Q_INVOKABLE void markMessageAsRead( Event* event );
             Q_INVOKABLE QString lastReadEvent(User* user);
 
+            /**
+             * @brief Serializes the room state and the tail of the timeline
+             *
+             * The result has the same layout as the room object in a /sync
+             * response, so it can be fed back through SyncRoomData.
+             */
+            QJsonObject toJson() const;
+
+            /**
+             * @brief Saves the loaded timeline to an event store file
+             *
+             * Unlike toJson(), this is meant for the whole history; see
+             * EventStore for the format.
+             */
+            bool saveHistory(const QString& path) const;
+            /**
+             * @brief Attaches an event store saved by saveHistory()
+             *
+             * Events from the store are not loaded right away; instead,
+             * getPreviousContent() pages them in before going to the server.
+             * Events evicted from the timeline are saved to the same file;
+             * it's fine to call this for a file that doesn't exist yet.
+             * Turns on Event::setKeepOriginalJson(), which saving needs;
+             * events received before that are not saved.
+             */
+            bool loadHistory(const QString& path);
+
+            /**
+             * @brief Limits the number of events kept in memory
+             *
+             * Each sync that leaves the timeline longer than maxEvents
+             * trims it with trimTimeline(). 0 (the default) means no limit.
+             *
+             * The limit counts events, not bytes, so memory use depends on
+             * the event sizes and on Event::setKeepOriginalJson(). The
+             * current state is kept regardless of the limit, and the arena
+             * of a sync batch is only freed when all its events are gone,
+             * so one partially evicted batch may stay allocated.
+             */
+            void setTimelineLimit(int maxEvents);
+            int timelineLimit() const;
+            /**
+             * @brief Evicts the earliest events from the timeline
+             *
+             * Evicted events are deleted after aboutToEvictMessages(). If
+             * loadHistory() was called, they are saved to the event store;
+             * otherwise the timeline is only cut where the server can
+             * paginate back from, so it may keep more than maxEvents.
+             * Either way, getPreviousContent() brings the events back.
+             * @return the number of evicted events
+             */
+            int trimTimeline(int maxEvents);
+
             Q_INVOKABLE int notificationCount() const;
             Q_INVOKABLE void resetNotificationCount();
             Q_INVOKABLE int highlightCount() const;
@@ -82,7 +183,27 @@ namespace QMatrixClient
             void userRenamed(User* user, QString oldName);
 
         signals:
+            /** Only emitted if enabled by setNewMessageSignalEnabled() */
             void newMessage(Event* event);
+            /**
+             * A batch of count events (a sync, a page of history) is about to
+             * go to timeline() at position; emitted when the new events end up
+             * together before or after all existing ones.
+             */
+            void aboutToInsertMessages(int position, int count);
+            void messagesInserted(int position, int count);
+            /**
+             * A batch of events is about to be interleaved with the events
+             * in timeline(); views should reload it after messagesReset().
+             */
+            void aboutToResetMessages();
+            void messagesReset();
+            /**
+             * The first count events of timeline() are about to be removed
+             * and deleted; pointers to them must be dropped.
+             */
+            void aboutToEvictMessages(int count);
+            void messagesEvicted(int count);
             /**
              * Triggered when the room name, canonical alias or other aliases
              * change. Not triggered when displayname changes.
@@ -92,6 +213,8 @@ namespace QMatrixClient
             void displaynameChanged(Room* room);
             void topicChanged();
             void userAdded(User* user);
+            /** Emitted instead of userAdded() when members are added in bulk */
+            void usersAdded(QList<User*> users);
             void userRemoved(User* user);
             void memberRenamed(User* user);
             void joinStateChanged(JoinState oldState, JoinState newState);
@@ -101,8 +224,28 @@ namespace QMatrixClient
 
         protected:
             Connection* connection() const;
+            /**
+             * Called for each event added to the timeline, including those
+             * added in batches by processMessageEvents(). In the latter case
+             * the base implementation only collects the event, and the whole
+             * batch gets into the timeline at the end of the batch.
+             */
             virtual void processMessageEvent(Event* event);
+            /**
+             * Adds a batch of events to the timeline. The base implementation
+             * calls processMessageEvent() for each event, then merges all of
+             * them into the timeline in one pass, which is much cheaper than
+             * inserting them one by one.
+             */
+            virtual void processMessageEvents(const QList<Event*>& events);
+            /**
+             * Events from the state part of a sync that don't end up as
+             * the current state are deleted after this call, and so are
+             * the ones that have been replaced as the current state, unless
+             * they are in the timeline.
+             */
             virtual void processStateEvent(Event* event);
+            /** The event is deleted after this call */
             virtual void processEphemeralEvent(Event* event);
 
         private:
@@ -0,0 +1,231 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "timeline.h"
+
+#include <algorithm>
+
+#include "events/event.h"
+
+using namespace QMatrixClient;
+
+Timeline::Timeline()
+    : count(0)
+{
+}
+
+bool Timeline::isEmpty() const
+{
+    return count == 0;
+}
+
+int Timeline::size() const
+{
+    return count;
+}
+
+Event* Timeline::front() const
+{
+    return pages.front().front();
+}
+
+Event* Timeline::back() const
+{
+    return pages.back().back();
+}
+
+Timeline::const_iterator Timeline::begin() const
+{
+    return const_iterator(&pages, 0, 0);
+}
+
+Timeline::const_iterator Timeline::end() const
+{
+    return const_iterator(&pages, pages.size(), 0);
+}
+
+Timeline::const_iterator Timeline::find(const Event* event) const
+{
+    const qint64 ts = event->timestampMsecs();
+    auto pageIt = std::lower_bound(pages.begin(), pages.end(), ts,
+        [](const page_t& p, qint64 t) { return p.back()->timestampMsecs() < t; });
+    if( pageIt == pages.end() )
+        return end();
+    auto pos = std::lower_bound(pageIt->begin(), pageIt->end(), ts,
+        [](const Event* e, qint64 t) { return e->timestampMsecs() < t; });
+    // Events with the same timestamp may go on for more than one page
+    for( const_iterator it(&pages, pageIt - pages.begin(), pos - pageIt->begin());
+         it != end() && (*it)->timestampMsecs() == ts; ++it )
+    {
+        if( *it == event )
+            return it;
+    }
+    return end();
+}
+
+int Timeline::insertionPoint(qint64 earliest, qint64 latest) const
+{
+    // Keep in sync with the fast paths in insert() and merge()
+    if( isEmpty() || back()->timestampMsecs() < earliest )
+        return count;
+    if( latest <= front()->timestampMsecs() )
+        return 0;
+    return -1;
+}
+
+QList<Event*> Timeline::toList() const
+{
+    QList<Event*> result;
+    result.reserve(count);
+    for( const page_t& page: pages )
+        for( Event* e: page )
+            result.push_back(e);
+    return result;
+}
+
+void Timeline::append(Event* event)
+{
+    if( pages.empty() || pages.back().size() >= PageSize )
+    {
+        pages.push_back(page_t());
+        pages.back().reserve(PageSize);
+    }
+    pages.back().push_back(event);
+    ++count;
+}
+
+void Timeline::prepend(Event* event)
+{
+    // Moving at most PageSize pointers keeps this O(1)
+    if( pages.empty() || pages.front().size() >= PageSize )
+    {
+        pages.push_front(page_t());
+        pages.front().reserve(PageSize);
+    }
+    pages.front().prepend(event);
+    ++count;
+}
+
+void Timeline::insert(Event* event)
+{
+    const qint64 ts = event->timestampMsecs();
+    if( isEmpty() || back()->timestampMsecs() < ts )
+    {
+        append(event);
+        return;
+    }
+    if( ts <= front()->timestampMsecs() )
+    {
+        prepend(event);
+        return;
+    }
+
+    // The first page that has events not earlier than the new one; there's
+    // always one, as back() is not earlier.
+    auto pageIt = std::lower_bound(pages.begin(), pages.end(), ts,
+        [](const page_t& p, qint64 t) { return p.back()->timestampMsecs() < t; });
+    page_t& page = *pageIt;
+    auto pos = std::lower_bound(page.begin(), page.end(), ts,
+        [](const Event* e, qint64 t) { return e->timestampMsecs() < t; });
+    page.insert(pos, event);
+    ++count;
+
+    if( page.size() >= 2 * PageSize )
+    {
+        const page_t tail = page.mid(PageSize);
+        page.resize(PageSize);
+        pages.insert(pageIt + 1, tail);
+    }
+}
+
+void Timeline::prependPages(const page_t& events)
+{
+    // Cut from the end, so that only the front page may be incomplete
+    // and prepend() fills it up
+    for( int end = events.size(); end > 0; end -= PageSize )
+    {
+        const int begin = std::max(0, end - PageSize);
+        pages.push_front(events.mid(begin, end - begin));
+    }
+    count += events.size();
+}
+
+Timeline::page_t Timeline::takeFront(int n)
+{
+    page_t result;
+    result.reserve(std::min(n, count));
+    while( n > 0 && !pages.empty() )
+    {
+        page_t& page = pages.front();
+        if( page.size() <= n )
+        {
+            // Whole pages are removed without touching the rest
+            n -= page.size();
+            result += page;
+            pages.pop_front();
+            continue;
+        }
+        result += page.mid(0, n);
+        page.remove(0, n);
+        n = 0;
+    }
+    count -= result.size();
+    return result;
+}
+
+static bool earlier(const Event* a, const Event* b)
+{
+    return a->timestampMsecs() < b->timestampMsecs();
+}
+
+void Timeline::merge(page_t events)
+{
+    if( events.isEmpty() )
+        return;
+
+    std::stable_sort(events.begin(), events.end(), earlier);
+    if( isEmpty() || back()->timestampMsecs() < events.front()->timestampMsecs() )
+    {
+        for( Event* e: events )
+            append(e);
+        return;
+    }
+    if( events.back()->timestampMsecs() <= front()->timestampMsecs() )
+    {
+        prependPages(events);
+        return;
+    }
+
+    // Only the pages starting from the first one that has events not
+    // earlier than the batch need to be rebuilt.
+    const qint64 ts = events.front()->timestampMsecs();
+    auto firstPage = std::lower_bound(pages.begin(), pages.end(), ts,
+        [](const page_t& p, qint64 t) { return p.back()->timestampMsecs() < t; });
+    page_t existing;
+    for( auto it = firstPage; it != pages.end(); ++it )
+        existing += *it;
+    count -= existing.size();
+    pages.erase(firstPage, pages.end());
+
+    page_t merged(existing.size() + events.size());
+    // On equal timestamps, std::merge takes from the first range - the batch
+    std::merge(events.begin(), events.end(), existing.begin(), existing.end(),
+               merged.begin(), earlier);
+    for( Event* e: merged )
+        append(e);
+}
@@ -0,0 +1,158 @@
+/******************************************************************************
+ * Copyright (C) 2016 Kitsune Ral <kitsune-ral@users.sf.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef QMATRIXCLIENT_TIMELINE_H
+#define QMATRIXCLIENT_TIMELINE_H
+
+#include <cstddef>
+#include <deque>
+#include <iterator>
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+namespace QMatrixClient
+{
+    class Event;
+
+    /**
+     * @brief A sequence of events sorted by timestamp
+     *
+     * Events are kept in pages of up to PageSize events (twice as many
+     * after insertions in the middle); adding an event at either end only
+     * touches the page at that end, and a whole batch of older events can be
+     * put in front as new pages without moving anything that's already there.
+     * Pages are never empty.
+     */
+    class Timeline
+    {
+        public:
+            typedef QVector<Event*> page_t;
+            static const int PageSize = 256;
+
+            class const_iterator
+            {
+                public:
+                    typedef std::bidirectional_iterator_tag iterator_category;
+                    typedef Event* value_type;
+                    typedef std::ptrdiff_t difference_type;
+                    typedef Event* const* pointer;
+                    typedef Event* const& reference;
+
+                    const_iterator()
+                        : pages(nullptr), page(0), offset(0)
+                    { }
+
+                    reference operator*() const
+                    {
+                        return (*pages)[page][offset];
+                    }
+                    const_iterator& operator++()
+                    {
+                        if( ++offset == (*pages)[page].size() )
+                        {
+                            ++page;
+                            offset = 0;
+                        }
+                        return *this;
+                    }
+                    const_iterator& operator--()
+                    {
+                        if( offset == 0 )
+                            offset = (*pages)[--page].size();
+                        --offset;
+                        return *this;
+                    }
+                    bool operator==(const const_iterator& other) const
+                    {
+                        return page == other.page && offset == other.offset;
+                    }
+                    bool operator!=(const const_iterator& other) const
+                    {
+                        return !operator==(other);
+                    }
+
+                private:
+                    friend class Timeline;
+                    const_iterator(const std::deque<page_t>* pages,
+                                   std::size_t page, int offset)
+                        : pages(pages), page(page), offset(offset)
+                    { }
+
+                    const std::deque<page_t>* pages;
+                    std::size_t page;
+                    int offset;
+            };
+
+            Timeline();
+
+            bool isEmpty() const;
+            int size() const;
+            Event* front() const;
+            Event* back() const;
+            const_iterator begin() const;
+            const_iterator end() const;
+            /**
+             * Finds the position of an event in the timeline by its timestamp;
+             * returns end() if the event is not there.
+             */
+            const_iterator find(const Event* event) const;
+            /**
+             * Where events with timestamps from earliest to latest would go
+             * with insert() or merge(): size() if after all events, 0 if
+             * before all events, or -1 if they'd be interleaved with events
+             * that are already there.
+             */
+            int insertionPoint(qint64 earliest, qint64 latest) const;
+            /** Makes a copy of the whole timeline; this is O(size()) */
+            QList<Event*> toList() const;
+
+            /** Adds an event after all others, regardless of its timestamp */
+            void append(Event* event);
+            /** Adds an event before all others, regardless of its timestamp */
+            void prepend(Event* event);
+            /**
+             * Adds an event before the first one with the same or a later
+             * timestamp (the same position as findInsertionPos() gives).
+             * Takes O(1) at either end, O(log(size()) + PageSize) otherwise.
+             */
+            void insert(Event* event);
+            /**
+             * Puts events, which must be sorted and not later than front(),
+             * in front of the timeline as new pages.
+             */
+            void prependPages(const page_t& events);
+            /**
+             * Adds a batch of events in any order. The batch is sorted once
+             * and merged with the part of the timeline it overlaps in
+             * a single pass, so this takes O(m log m + n) at worst instead of
+             * O(m * n) for inserting events one by one. Each event ends up
+             * where insert() would put it, except that events of the batch
+             * with equal timestamps keep their order.
+             */
+            void merge(page_t events);
+            /** Removes up to count earliest events and returns them */
+            page_t takeFront(int count);
+
+        private:
+            std::deque<page_t> pages;
+            int count;
+    };
+}
+
+#endif // QMATRIXCLIENT_TIMELINE_H